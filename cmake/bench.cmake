@@ -0,0 +1,74 @@
+# Benchmark of the emulator, run by the bench target: every scenario
+# below is run against sr and gbn built with -DTIMING, and the JSON
+# reports are gathered into ${OUTPUT_DIR}/results.json as
+#   {"results": [{"scenario": ..., "protocol": ..., "report": {...}}, ...]}
+# Each report holds the events handled per second, the nanoseconds per
+# call of each handler (insertevent, tolayer3, A_input, ...), the peak
+# resident memory and the number of allocations; see stats.h.
+#
+# A scenario is <name>|<window>|<answers>|<options>: the window picks the
+# *_timing or *_timing_w<window> binary, the answers are fed to the
+# emulator's questions (messages loss corrupt direction lambda trace),
+# and the options go on its command line.  lambda is kept where GBN does
+# not collapse under its own resends; with 32 packets to go back that
+# needs messages no faster than one per 50 time units.
+
+cmake_policy(VERSION 3.13)   # keep the empty options field of a scenario
+
+set(scenarios
+  "low_loss|6|200000 0.01 0.01 2 50 0|"
+  "high_loss|6|200000 0.3 0.0 2 50 0|"
+  "high_corruption|6|200000 0.0 0.3 2 100 0|"
+  "small_window|2|200000 0.05 0.05 2 10 0|"
+  "large_window|32|200000 0.05 0.05 2 50 0|"
+  "million_messages|6|1000000 0.05 0.05 2 50 0|"
+  "bidirectional|6|200000 0.05 0.05 2 50 0|-b"
+  "many_flows|6|200000 0.05 0.05 2 500 0|-f 100 -l 0.05")
+
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+set(results "")
+foreach(scenario ${scenarios})
+  string(REPLACE "|" ";" fields "${scenario}")
+  list(GET fields 0 name)
+  list(GET fields 1 window)
+  list(GET fields 2 answers)
+  list(GET fields 3 options)
+  separate_arguments(options UNIX_COMMAND "${options}")
+  file(WRITE ${OUTPUT_DIR}/${name}.txt "${answers}\n")
+
+  foreach(protocol sr gbn)
+    set(program ${BINARY_DIR}/${protocol}_timing)
+    if(NOT window EQUAL 6)
+      set(program ${program}_w${window})
+    endif()
+    set(report ${OUTPUT_DIR}/${name}_${protocol}.json)
+    # one sample for the whole run, so sampling costs next to nothing
+    execute_process(
+      COMMAND ${program} ${options} -j ${report} -i 1e12
+      INPUT_FILE ${OUTPUT_DIR}/${name}.txt
+      OUTPUT_QUIET
+      RESULT_VARIABLE result)
+    if(result)
+      message(FATAL_ERROR "${protocol} failed on ${name}")
+    endif()
+
+    file(READ ${report} json)
+    string(STRIP "${json}" json)
+    if(results)
+      string(APPEND results ",\n")
+    endif()
+    string(APPEND results
+      "{\"scenario\": \"${name}\", \"protocol\": \"${protocol}\", \"window\": ${window}, \"report\": ${json}}")
+
+    string(REGEX MATCH "\"events_per_second\": ([0-9]+)" _ "${json}")
+    set(rate ${CMAKE_MATCH_1})
+    string(REGEX MATCH "\"allocations\": ([0-9]+)" _ "${json}")
+    set(allocations ${CMAKE_MATCH_1})
+    string(REGEX MATCH "\"max_rss_kb\": ([0-9]+)" _ "${json}")
+    set(rss ${CMAKE_MATCH_1})
+    message(STATUS "${name} ${protocol}: ${rate} events/s, ${allocations} allocations, ${rss} kB peak")
+  endforeach()
+endforeach()
+
+file(WRITE ${OUTPUT_DIR}/results.json "{\"results\": [\n${results}\n]}\n")
+message(STATUS "benchmark results are in ${OUTPUT_DIR}/results.json")
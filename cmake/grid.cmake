@@ -0,0 +1,109 @@
+# Link efficiency of sr against gbn, run by the grid target: both are run
+# at every point of a grid of loss, corruption, lambda and window size,
+# and the results are written side by side to ${OUTPUT_DIR}/results.csv
+#   loss,corrupt,lambda,window,sr_goodput,gbn_goodput,sr_overhead,...
+# and in full to ${OUTPUT_DIR}/results.json.  Goodput is messages
+# delivered per time unit, overhead is packets resent over packets sent
+# into layer 3, and the percentiles are of the A to B message delay.
+#
+# A protocol that has not finished MESSAGES messages within TIMEOUT
+# seconds has collapsed under its own resends (GBN with a large window
+# and a busy medium does); its columns are left empty.
+
+cmake_policy(VERSION 3.13)
+
+if(NOT MESSAGES)
+  set(MESSAGES 20000)
+endif()
+if(NOT TIMEOUT)
+  set(TIMEOUT 5)
+endif()
+
+set(losses 0.0 0.1 0.2)
+set(corrupts 0.0 0.1 0.2)
+set(lambdas 20 50 100)
+set(windows 2 6 32)
+set(protocols sr gbn)
+set(columns goodput overhead p50 p99 p999)
+
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+set(header "loss,corrupt,lambda,window")
+foreach(column ${columns})
+  foreach(protocol ${protocols})
+    string(APPEND header ",${protocol}_${column}")
+  endforeach()
+endforeach()
+set(csv "${header}\n")
+set(json "")
+
+foreach(loss ${losses})
+  foreach(corrupt ${corrupts})
+    foreach(lambda ${lambdas})
+      foreach(window ${windows})
+        set(point "loss ${loss} corrupt ${corrupt} lambda ${lambda} window ${window}")
+        # the emulator only asks which direction to damage if there is damage
+        if(loss STREQUAL "0.0" AND corrupt STREQUAL "0.0")
+          set(direction "")
+        else()
+          set(direction " 2")
+        endif()
+        file(WRITE ${OUTPUT_DIR}/answers.txt "${MESSAGES} ${loss} ${corrupt}${direction} ${lambda} 0\n")
+        foreach(protocol ${protocols})
+          set(program ${BINARY_DIR}/${protocol}_timing)
+          if(NOT window EQUAL 6)
+            set(program ${program}_w${window})
+          endif()
+          set(report ${OUTPUT_DIR}/report.json)
+          file(REMOVE ${report})
+          execute_process(
+            COMMAND ${program} -j ${report} -i 1e12
+            INPUT_FILE ${OUTPUT_DIR}/answers.txt
+            OUTPUT_QUIET
+            TIMEOUT ${TIMEOUT}
+            RESULT_VARIABLE result)
+          foreach(column ${columns})
+            set(${protocol}_${column} "")
+          endforeach()
+          if(result STREQUAL "0")
+            file(READ ${report} report)
+            string(REGEX MATCH "\"goodput\": ([0-9.]+)" _ "${report}")
+            set(${protocol}_goodput ${CMAKE_MATCH_1})
+            string(REGEX MATCH "\"retransmission_overhead\": ([0-9.]+)" _ "${report}")
+            set(${protocol}_overhead ${CMAKE_MATCH_1})
+            foreach(p p50 p99 p999)
+              string(REGEX MATCH "\"A_to_B\": {[^}]*\"${p}\": ([0-9.]+)" _ "${report}")
+              set(${protocol}_${p} ${CMAKE_MATCH_1})
+            endforeach()
+            message(STATUS "${point} ${protocol}: goodput ${${protocol}_goodput} "
+                           "overhead ${${protocol}_overhead} p99 ${${protocol}_p99}")
+          else()
+            message(STATUS "${point} ${protocol}: did not finish (${result})")
+          endif()
+        endforeach()
+
+        set(row "${loss},${corrupt},${lambda},${window}")
+        set(object "{\"loss\": ${loss}, \"corrupt\": ${corrupt}, \"lambda\": ${lambda}, \"window\": ${window}")
+        foreach(column ${columns})
+          foreach(protocol ${protocols})
+            string(APPEND row ",${${protocol}_${column}}")
+            if("${${protocol}_${column}}" STREQUAL "")
+              string(APPEND object ", \"${protocol}_${column}\": null")
+            else()
+              string(APPEND object ", \"${protocol}_${column}\": ${${protocol}_${column}}")
+            endif()
+          endforeach()
+        endforeach()
+        string(APPEND csv "${row}\n")
+        if(json)
+          string(APPEND json ",\n")
+        endif()
+        string(APPEND json "${object}}")
+      endforeach()
+    endforeach()
+  endforeach()
+endforeach()
+
+file(WRITE ${OUTPUT_DIR}/results.csv "${csv}")
+file(WRITE ${OUTPUT_DIR}/results.json "{\"messages\": ${MESSAGES}, \"grid\": [\n${json}\n]}\n")
+file(REMOVE ${OUTPUT_DIR}/answers.txt ${OUTPUT_DIR}/report.json)
+message(STATUS "grid results are in ${OUTPUT_DIR}/results.csv and results.json")
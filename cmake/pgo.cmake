@@ -0,0 +1,67 @@
+# Profile guided build of sr and gbn, run by the pgo target:
+#   1. build with -fprofile-generate
+#   2. run every workload in workloads/ against both protocols
+#   3. rebuild with -fprofile-use
+# Each workloads/<name>.txt holds the answers to the emulator's questions,
+# and an optional workloads/<name>.args its command line options.
+
+set(profile_dir ${BINARY_DIR}/profiles)
+file(REMOVE_RECURSE ${profile_dir})
+file(GLOB_RECURSE stale ${BINARY_DIR}/*.gcda)
+if(stale)
+  file(REMOVE ${stale})
+endif()
+
+foreach(step GENERATE USE)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -S ${SOURCE_DIR} -B ${BINARY_DIR}
+            -DCMAKE_BUILD_TYPE=Release
+            -DCMAKE_C_COMPILER=${C_COMPILER}
+            -DSIM_LTO=${LTO}
+            -DSIM_TIMING_TARGETS=OFF
+            -DSIM_PGO=${step}
+            -DSIM_PGO_DIR=${profile_dir}
+    RESULT_VARIABLE result)
+  if(result)
+    message(FATAL_ERROR "configuring the ${step} build failed")
+  endif()
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} --build ${BINARY_DIR} --clean-first --target sr gbn
+    RESULT_VARIABLE result)
+  if(result)
+    message(FATAL_ERROR "the ${step} build failed")
+  endif()
+
+  if(step STREQUAL "GENERATE")
+    file(GLOB workloads ${SOURCE_DIR}/workloads/*.txt)
+    foreach(workload ${workloads})
+      string(REGEX REPLACE "\\.txt$" ".args" argsfile ${workload})
+      set(args "")
+      if(EXISTS ${argsfile})
+        file(READ ${argsfile} args)
+        separate_arguments(args UNIX_COMMAND "${args}")
+      endif()
+      foreach(protocol sr gbn)
+        message(STATUS "training ${protocol} on ${workload}")
+        execute_process(
+          COMMAND ${BINARY_DIR}/${protocol} ${args}
+          INPUT_FILE ${workload}
+          OUTPUT_QUIET
+          RESULT_VARIABLE result)
+        if(result)
+          message(FATAL_ERROR "${protocol} failed on ${workload}")
+        endif()
+      endforeach()
+    endforeach()
+    if(NOT C_COMPILER_ID STREQUAL "GNU")
+      # clang writes raw profiles that must be merged first
+      file(GLOB raw ${profile_dir}/*.profraw)
+      execute_process(COMMAND llvm-profdata merge -o ${profile_dir}/default.profdata ${raw}
+                      RESULT_VARIABLE result)
+      if(result)
+        message(FATAL_ERROR "merging the profiles with llvm-profdata failed")
+      endif()
+    endif()
+  endif()
+endforeach()
+message(STATUS "profile guided sr and gbn are in ${BINARY_DIR}")
@@ -1,478 +1,2403 @@
-/* ***** THIS FILE SHOULD NOT BE MODIFIED ****************************
-   THERE IS NOT REASON THAT ANY STUDENT SHOULD HAVE TO READ OR UNDERSTAND
-   THE CODE BELOW.  YOU SHOLD NOT TOUCH, OR REFERENCE (in your code) ANY
-   OF THE DATA STRUCTURES BELOW.  If you're interested in how I designed
-   the emulator, you're welcome to look at the code - but again, you should have
-   to, and you defeinitely should not have to modify
-   This file contains the code that emulates the network.  It does not
-   implement any of the Go-Back-N protocol.
-   ********************************************************************
-
-   ******************************************************************
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
-   The code below emulates the layer 3 and below network environment:
-   - emulates the tranmission and delivery (possibly with bit-level corruption
-   and packet loss) of packets across the layer 3/4 interface
-   - handles the starting/stopping of a timer, and generates timer
-   interrupts (resulting in calling students timer handler).
-   - generates message to be sent (passed from later 5 to 4)
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications (6/6/2008 - CLP): 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - removed hard coded maximum random number, use library defined
-   RAND_MAX value 
-   - simulator stops when no events are left rather than stopping as
-   soon as n packets are sent.
-   - fixed C style to adhere to current programming style
-
-   ********************************************************************* */
-#include <stdlib.h>
-#include <stdio.h>
-#include "emulator.h"
-#include "gbn.h"
-
-struct event {
-  float evtime;           /* event time */
-  int evtype;             /* event type code */
-  int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
-};
-
-struct event *evlist = NULL;   /* the event list */
-
-/* possible events: */
-#define  TIMER_INTERRUPT 0  
-#define  FROM_LAYER5     1
-#define  FROM_LAYER3     2
-
-#define  OFF             0
-#define  ON              1
-
-int TRACE = 3;
-
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
-
-/****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
-/****************************************************************************/
-double jimsrand(void) 
-{
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
-  return(x);
-}  
-
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
-/*****************************************************/
-
-void insertevent(struct event *p)
-{
-  struct event *q,*qold;
-
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
-  }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
-  }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
-    }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
-    }
-  }
-}
-
-void generate_next_arrival(void)
-{
-  double x;
-  struct event *evptr;
-
-  if (TRACE>2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
- 
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
-  evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
-    evptr->eventity = B;
-  else
-    evptr->eventity = A;
-  insertevent(evptr);
-} 
-
-void printevlist(void)
-{
-  struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
-  }
-  printf("--------------\n");
-}
-
-void init(void)                         /* initialize the simulator */
-{
-  float sum, avg;
-  int i;
-
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
-  }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
-  }
-
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
-
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
-}
-
-/********************** Student-callable ROUTINES ***********************/
-
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
-{
-  struct event *q;
-
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
-}
-
-
-void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
-{
-
-  struct event *q;
-  struct event *evptr;
-
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
- 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
-  evptr->evtype =  TIMER_INTERRUPT;
-   
- 
-  evptr->eventity = AorB;
-  insertevent(evptr);
-} 
-
-
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
-{
-  struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
-
-  ntolayer3++;
-
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being lost\n");
-    return;
-  }  
-
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
-  }
-
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
-  evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
-
-
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being corrupted\n");
-  }  
-
-  if (TRACE>2)  
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
-} 
-
-void tolayer5(int AorB, char datasent[20])
-{
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
-  }
-  messages_delivered++;
-}
-
-int main(void)
-{
-  struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
-  while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
-    }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
-      }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
-    }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
-    }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
-    }
-    free(eventptr);
-  }
-
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+/* ***** THIS FILE SHOULD NOT BE MODIFIED ****************************
+   THERE IS NOT REASON THAT ANY STUDENT SHOULD HAVE TO READ OR UNDERSTAND
+   THE CODE BELOW.  YOU SHOLD NOT TOUCH, OR REFERENCE (in your code) ANY
+   OF THE DATA STRUCTURES BELOW.  If you're interested in how I designed
+   the emulator, you're welcome to look at the code - but again, you should have
+   to, and you defeinitely should not have to modify
+   This file contains the code that emulates the network.  It does not
+   implement any of the Go-Back-N protocol.
+   ********************************************************************
+
+   ******************************************************************
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.1  J.F.Kurose
+   The code below emulates the layer 3 and below network environment:
+   - emulates the tranmission and delivery (possibly with bit-level corruption
+   and packet loss) of packets across the layer 3/4 interface
+   - handles the starting/stopping of a timer, and generates timer
+   interrupts (resulting in calling students timer handler).
+   - generates message to be sent (passed from later 5 to 4)
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost), unless the reordering channel is
+   selected on the command line (see usage()).
+   - any number of flows, each an A and B pair, can share the medium.
+   Flow f is made of entities 2f (its A) and 2f+1 (its B), and packets
+   are routed to the flow named in their connid field.  Packets of
+   different flows are not ordered with respect to each other, but can
+   be made to queue for a shared link of limited rate.
+
+   Modifications (6/6/2008 - CLP): 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - removed hard coded maximum random number, use library defined
+   RAND_MAX value 
+   - simulator stops when no events are left rather than stopping as
+   soon as n packets are sent.
+   - fixed C style to adhere to current programming style
+
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "protocol.h"
+#include "stats.h"
+#include "replay.h"
+
+struct event {
+  double evtime;          /* event time */
+  int evtype;             /* event type code */
+  int eventity;           /* entity where event occurs */
+  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
+  int creator;            /* entity that created the event, and how many */
+  long seq;               /*   it had created before; orders events at the same time */
+  struct event *prev;
+  struct event *next;
+};
+
+_Thread_local struct event *evlist = NULL;   /* the event list */
+
+/* entity numbers: each flow has an A and a B */
+#define  ENTITY(flow, AorB)  (2*(flow) + (AorB))
+#define  FLOW(entity)        ((entity) / 2)
+#define  SIDE(entity)        ((entity) % 2)
+
+/* possible events: */
+#define  TIMER_INTERRUPT 0  
+#define  FROM_LAYER5     1
+#define  FROM_LAYER3     2
+#define  ACK_TIMER       3
+#define  PACE_TIMER      4
+#define  LAYER5_READY    5
+
+#define  OFF             0
+#define  ON              1
+
+int TRACE = 3;
+int bidirectional = BIDIRECTIONAL;
+int nflows = 1;        /* number of A and B pairs sharing the medium */
+_Thread_local int current_flow = 0;  /* flow of the entity the emulator is calling */
+
+/* statistics updated by emulator; the rest are the counters in stats.h */
+static int *delivered;             /* messages delivered, indexed by the receiving entity */
+
+static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
+static int nsimmax = 0;           /* number of msgs to generate, then stop */
+static _Thread_local double simtime = 0.000; /* double, as a float runs out of precision in long runs */
+static float lossprob;            /* probability that a packet is dropped  */
+static float corruptprob;   /* probability that one bit is packet is flipped */
+static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
+static float lambda;        /* arrival rate of messages from layer 5 */   
+
+/* optional channel behaviour, selected on the command line */
+static int reorder = 0;           /* 0 = FIFO medium, 1 = medium may reorder */
+static float reorderprob = 0.0;   /* probability that a packet is held back */
+static float reorderdepth = 0.0;  /* max extra delay of a held back packet */
+static float dupprob = 0.0;       /* probability that a packet is duplicated */
+static double *lastarrival;       /* latest arrival time scheduled, indexed by entity */
+static float linkservice = 0.0;   /* time the shared link takes to send a packet */
+static double readservice = 0.0;  /* time an application takes to read a message */
+static int nstreams = 1;          /* streams layer 5 spreads the messages over */
+static double lifetime = 0.0;     /* time a message is worth delivering in, 0 for ever */
+static const struct protocol *protocol;       /* the protocol being run */
+static const struct protocol *const *runs = protocols;  /* those to run in turn */
+static int nruns = 1;
+static struct histogram *streamlatency;  /* message delay, indexed by stream */
+static double *readfree;          /* when it can read the next, indexed by entity */
+static int *readwait;             /* it owes the protocol a call when it can */
+static double linkfree[2];         /* when the shared link towards any A or any B is idle */
+
+/* the running timer events, so stopping one needs no search of the list.
+   Indexed by entity; the delayed ACK timers follow the retransmission ones,
+   and the pacing timers follow them */
+#define NTIMERS 3
+static struct event **timers;
+
+/* send times of the messages each entity has accepted but the other side
+   has not yet delivered, oldest first, as both protocols deliver in order.
+   Only the sender adds and only the receiver takes, so with the parallel
+   engine the two may be in different threads: the times are kept in a
+   list of chunks, and added is the one count both of them read */
+#define SENDCHUNK 64
+struct sendchunk {
+  double t[SENDCHUNK];
+  struct sendchunk *next;
+};
+struct sendtimes {
+  struct sendchunk *head;         /* taken from by the receiver */
+  struct sendchunk *tail;         /* added to by the sender */
+  long taken;
+  atomic_long added;
+};
+static struct sendtimes *unacked;   /* indexed by SENDQUEUE() */
+#define SENDQUEUE(entity, stream)  ((entity)*nstreams + (stream))
+static _Thread_local struct histogram latency[2]; /* message delay, indexed by the sending A or B */
+static _Thread_local struct histogram queueing;   /* time packets wait behind others to go */
+
+/* goodput and window sampled every sampleinterval for the output files */
+struct sample {
+  double time;
+  int delivered;                    /* messages delivered since the last sample */
+  long outstanding;
+  long inmedium;
+};
+static char *jsonfile = NULL;       /* where to write the report as JSON */
+static char *csvfile = NULL;        /* where to write the samples as CSV */
+static float sampleinterval = 100.0;
+static double nextsample;
+static long lastdelivered;          /* messages delivered at the last sample */
+static struct sample *samples;
+static int nsamples, samplesize;
+
+/* layer 5 data from a file, selected with -s.  Each sending entity gives
+   the file 20 bytes at a time, the last message padded with zeros, and
+   offers a message again until it is accepted.  Each receiving entity
+   compares what it is given with the file as it goes, and with -o the
+   data delivered to the B of flow 0 is written out.  Both files are
+   mapped, so neither is ever read into memory as a whole */
+static char *sourcefile = NULL;
+static char *sinkfile = NULL;
+static char *source;                /* the mapped files */
+static char *sink;
+static long sourcesize;
+static int sinkfd;
+static long *streamed;              /* bytes accepted, indexed by the sending entity */
+static long *received;              /* bytes delivered, indexed by the receiving entity */
+static long *firstbad;              /* offset of the first wrong byte delivered, or -1 */
+static long streambytes;            /* bytes accepted by all senders, for the report */
+static int streamok;                /* all of them delivered intact */
+
+/* the random decisions of a run, written to a log with -w and taken from
+   one with -x (see replay.h).  Each flow has a stream for the messages
+   layer 5 gives it and each entity one for the fates of the packets it
+   sends, which are decided all at once when a packet is sent.  A stream
+   that runs out, as it may if the protocol has been changed, goes on
+   with fresh draws.  Uniform draws are kept as the 31 bits random() gave,
+   so they are replayed exactly */
+#define ARRIVALSTREAM(flow)   (flow)
+#define PACKETSTREAM(entity)  (nflows + (entity))
+#define NSTREAMS              (3*nflows)
+
+struct fate {
+  int lost;
+  int corrupt;              /* 0, or what is damaged: 1 payload, 2 seqnum, 3 acknum */
+  int copies;               /* 2 if the medium duplicates the packet */
+  double delay[2];          /* uniform draw for the delay of each copy */
+  int held[2];              /* copy held back by the reordering medium */
+  double depth[2];          /*   by this fraction of reorderdepth */
+};
+static char *recordfile = NULL;
+static char *replayfile = NULL;
+static long fresharrivals;          /* draws made after a stream ran out */
+static long freshfates;
+
+/* with more than one protocol to run (-P) each of these streams draws from
+   a generator of its own rather than from random(), so that the runs see
+   the same channel: as with replay, the nth packet an entity sends meets
+   the same fate in every run, whatever the protocol sent before it */
+static unsigned short (*drawstreams)[3];  /* erand48() state, indexed by stream */
+
+/* traffic sources, selected with -n, say when layer 5 gives each flow a
+   message.  A source fills in a batch of arrivals for a flow at a time,
+   and the flow's next FROM_LAYER5 event is taken from the batch:
+     uniform    time between messages uniform on [0, 2*lambda], drawn one
+                at a time as it always has been; the default
+     poisson    time between messages exponential, mean lambda
+     onoff      on and off periods, Pareto distributed with the given shape
+                and ONOFFPERIOD*lambda long on average, with messages
+                lambda/2 apart on average, exponentially, while on
+     cbr        a message every lambda
+     saturate   every lambda the sender is offered messages until it
+                refuses one, so it always has something to send
+     trace      the times listed in a file, one a line, each followed by
+                A or B to say which side with -b
+   The sides, when -b leaves them to chance, are drawn as for uniform;
+   cbr and saturate take turns.  Only the sequential engine has them */
+#define ARRIVALBATCH  32
+#define ONOFFPERIOD   10.0
+
+struct arrivals {
+  double t[ARRIVALBATCH];
+  int side[ARRIVALBATCH];
+  int next, count;          /* next to take, of those filled in */
+  double last;              /* time of the last arrival filled in */
+  double onend;             /* onoff: when the on period ends */
+  int turn;                 /* cbr and saturate: arrivals so far, for the side */
+  FILE *trace;
+  long offset;              /* trace: how far it has been read */
+};
+
+struct source {
+  char *name;
+  int (*fill)(int flow, struct arrivals *);  /* how many filled in, 0 at the end */
+  int saturate;             /* offer messages until one is refused */
+};
+static struct source *traffic;      /* in sources[] */
+static char *tracefile = NULL;
+static float onoffshape = 1.5;
+static struct arrivals *arrivals;   /* indexed by flow */
+
+/* checkpoints: with -k the state of the run is written to a file when
+   the simulated time reaches -a, and the run stops there.  A run with -g
+   goes on from such a file instead of starting afresh, with the numbers
+   given on stdin and the options it is given now, so many runs can fork
+   from one warmed-up state.  The number of flows must be the same */
+#define RANDSTATE 128               /* bytes of random() state */
+static char randstate[2][RANDSTATE];  /* random() state, one in use and a spare */
+static int randcurrent;
+static char *checkpointfile = NULL;
+static double checkpointtime = 0.0;
+static char *resumefile = NULL;
+
+/* early termination, selected with -c, -e or -m: the run stops once the
+   95% confidence intervals on goodput and on message delay, by batch
+   means (see stats.h), are within precision of their means, or once it
+   has used up its budget of wall-clock or simulated time.  The batches
+   start 10*lambda long */
+static float precision = 0.0;       /* relative half-width wanted, 0 for none */
+static float wallbudget = 0.0;      /* seconds, 0 for no limit */
+static float timebudget = 0.0;      /* simulated time, 0 for no limit */
+static int batching;                /* any of the three given */
+static struct batchmeans goodputbatches, delaybatches;
+static double batchstart;           /* when the first batch opened */
+static double batchend;             /* when the open one closes */
+static char *stopreason = NULL;     /* why the run stopped early, if it did */
+
+/* the parallel engine, selected with -p.  Entity e belongs to partition
+   e % npartitions, and each partition runs in a thread of its own, with
+   its own event list, clock and statistics.  A packet spends at least
+   LOOKAHEAD in the medium, so once the partitions agree on the earliest
+   pending event anywhere, each can handle its events up to LOOKAHEAD after
+   it without hearing from the others.  Packets for another partition are
+   pushed onto its mailbox, which it empties before the next such window.
+
+   Every entity draws from its own random number stream, and ties in time
+   are broken by the creator of each event, so the results do not depend
+   on the number of partitions.  They are not those of the sequential
+   engine: with -b A and B each generate their own messages, and
+   nsimmax is shared out between the sending entities in advance. */
+#define LOOKAHEAD  1.0      /* least time a packet spends in the medium */
+#define PART(entity)  ((entity) % npartitions)
+
+struct partition {
+  pthread_t thread;
+  _Atomic(struct event *) mailbox;  /* events from other partitions, unsorted */
+  double next;                      /* time of its earliest event, at the barrier */
+  double time;                      /* statistics, gathered when it finishes */
+  struct statsnapshot stats;
+  struct histogram latency[2];
+  struct histogram queueing;
+};
+static int npartitions = 0;         /* 0 for the sequential engine */
+static struct partition *partitions;
+static pthread_barrier_t barrier;
+static _Thread_local int mypartition;
+static _Thread_local int current_entity;  /* entity whose event is being handled */
+static unsigned short (*streams)[3];      /* erand48() state, indexed by entity */
+static long *evcount;               /* events created, indexed by entity */
+static int *msgcount;               /* messages given by layer 5, indexed by entity */
+
+/* allocate memory, counting the allocations and giving up if there is none */
+void *emalloc(size_t size, char *what)
+{
+  void *p = malloc(size);
+
+  if (p == 0) {
+    printf("memory allocation for %s failed.", what);
+    exit(EXIT_FAILURE);
+  }
+  run.allocations++;
+  GAUGE_ADD(G_BLOCKS, 1);
+  return p;
+}
+
+void efree(void *p)
+{
+  free(p);
+  GAUGE_ADD(G_BLOCKS, -1);
+}
+
+/****************************************************************************/
+/* jimsrand(): return a double in range [0,1].  The routine below is used to */
+/* isolate all random number generation in one location.  We assume that the*/
+/* system-supplied random() function return an int in therange [0,mmm]      */
+/****************************************************************************/
+#define RANDMAX 2147483647   /* largest value of random() */
+double jimsrand(void) 
+{
+  double mmm = RANDMAX;
+  double x;                   
+  if (streams != NULL)         /* the parallel engine, see below */
+    x = erand48(streams[current_entity]);
+  else
+    x = random()/mmm;          /* x should be uniform in [0,1] */
+  if (TRACE > 3)
+    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  return(x);
+}  
+
+/* a uniform draw for one of the streams of random decisions */
+static double streamrand(int stream)
+{
+  if (drawstreams == NULL)
+    return jimsrand();
+  return erand48(drawstreams[stream]);
+}
+
+/********************* RECORD AND REPLAY *******/
+
+static unsigned int toword(double x)
+{
+  return (unsigned int)(x * RANDMAX + 0.5);
+}
+
+static double fromword(unsigned int w)
+{
+  double mmm = RANDMAX;
+
+  return w/mmm;               /* as jimsrand() made it */
+}
+
+/* the next message from layer 5 for a flow: the uniform draw for when it
+   comes, and the side it goes to, A unless -b says B may be chosen */
+double drawarrival(int flow, int *side)
+{
+  unsigned int w;
+  double x;
+
+  if (replayfile != NULL) {
+    if (replay_getword(ARRIVALSTREAM(flow), &w)) {
+      *side = w >> 31;
+      return fromword(w & 0x7fffffff);
+    }
+    fresharrivals++;
+  }
+  x = streamrand(ARRIVALSTREAM(flow));
+  *side = (bidirectional && (streamrand(ARRIVALSTREAM(flow))>0.5)) ? B : A;
+  if (recordfile != NULL)
+    replay_putword(ARRIVALSTREAM(flow), toword(x) | (unsigned int)*side << 31);
+  return x;
+}
+
+/* a uniform draw for the length of an on or off period of a flow */
+double drawperiod(int flow)
+{
+  unsigned int w;
+  double x;
+
+  if (replayfile != NULL) {
+    if (replay_getword(ARRIVALSTREAM(flow), &w))
+      return fromword(w & 0x7fffffff);
+    fresharrivals++;
+  }
+  x = streamrand(ARRIVALSTREAM(flow));
+  if (recordfile != NULL)
+    replay_putword(ARRIVALSTREAM(flow), toword(x));
+  return x;
+}
+
+static void drawdelay(int stream, struct fate *f, int copy)
+{
+  f->delay[copy] = streamrand(stream);
+  f->held[copy] = reorder && reorderprob > 0.0 && streamrand(stream) < reorderprob;
+  if (f->held[copy])
+    f->depth[copy] = streamrand(stream);
+}
+
+/* decide the fate of a packet sent by entity, drawing in the order the
+   medium always has */
+static void drawfate(int entity, struct fate *f)
+{
+  int AorB = SIDE(entity), stream = PACKETSTREAM(entity);
+  int damage = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  float x;
+
+  f->lost = streamrand(stream) < lossprob && damage;
+  f->corrupt = 0;
+  f->copies = 1;
+  f->held[0] = f->held[1] = 0;
+  if (f->lost)
+    return;
+  drawdelay(stream, f, 0);
+  if (streamrand(stream) < corruptprob && damage) {
+    x = streamrand(stream);
+    f->corrupt = x < .75 ? 1 : x < .875 ? 2 : 3;
+  }
+  if (dupprob > 0.0 && streamrand(stream) < dupprob) {
+    f->copies = 2;
+    drawdelay(stream, f, 1);
+  }
+}
+
+/* a fate in the log is a byte of flags followed by the draws it needs */
+static void writefate(int stream, struct fate *f)
+{
+  int i;
+
+  replay_putbyte(stream, f->lost | f->corrupt << 1 | (f->copies == 2) << 3
+                         | f->held[0] << 4 | f->held[1] << 5);
+  for (i=0; !f->lost && i<f->copies; i++) {
+    replay_putword(stream, toword(f->delay[i]));
+    if (f->held[i])
+      replay_putword(stream, toword(f->depth[i]));
+  }
+}
+
+static int readfate(int stream, struct fate *f)
+{
+  unsigned char flags;
+  unsigned int w;
+  int i;
+
+  if (!replay_getbyte(stream, &flags))
+    return 0;
+  f->lost = flags & 1;
+  f->corrupt = (flags >> 1) & 3;
+  f->copies = (flags & 8) ? 2 : 1;
+  f->held[0] = (flags >> 4) & 1;
+  f->held[1] = (flags >> 5) & 1;
+  for (i=0; !f->lost && i<f->copies; i++) {
+    if (!replay_getword(stream, &w))
+      return 0;
+    f->delay[i] = fromword(w);
+    if (f->held[i]) {
+      if (!replay_getword(stream, &w))
+        return 0;
+      f->depth[i] = fromword(w);
+    }
+  }
+  return 1;
+}
+
+/* the fate of the next packet entity sends */
+void getfate(int entity, struct fate *f)
+{
+  if (replayfile != NULL) {
+    if (readfate(PACKETSTREAM(entity), f))
+      return;
+    freshfates++;
+  }
+  drawfate(entity, f);
+  if (recordfile != NULL)
+    writefate(PACKETSTREAM(entity), f);
+}
+
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+/* whether event p goes after event q on the event list */
+static int later(struct event *p, struct event *q)
+{
+  if (p->evtime != q->evtime || npartitions == 0)
+    return p->evtime > q->evtime;
+  return p->creator > q->creator || (p->creator == q->creator && p->seq > q->seq);
+}
+
+/* the last packet arrival scheduled by the tolayer3_batch() call being
+   made, or NULL.  The list is sorted, so an event that goes after it goes
+   after everything before it too, and the search can start there */
+static _Thread_local int bursting;
+static _Thread_local struct event *burst;
+
+/* push an event onto the mailbox of the partition it belongs to */
+void post(struct event *p)
+{
+  struct partition *to = &partitions[PART(p->eventity)];
+
+  p->next = atomic_load_explicit(&to->mailbox, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&to->mailbox, &p->next, p,
+                                                memory_order_release, memory_order_relaxed))
+    ;
+}
+
+void insertevent(struct event *p)
+{
+  struct event *q,*qold;
+
+  if (npartitions > 0 && PART(p->eventity) != mypartition) {
+    post(p);
+    return;
+  }
+  TIME_START(T_INSERTEVENT);
+
+  if (TRACE>2) {
+    printf("            INSERTEVENT: time is %f\n",simtime);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  q = evlist;     /* q points to front of list in which p struct inserted */
+  if (burst != NULL && later(p, burst))
+    q = burst;
+  if (q==NULL) {   /* list is empty */
+    evlist=p;
+    p->next=NULL;
+    p->prev=NULL;
+  }
+  else {
+    for (qold = q; q !=NULL && later(p, q); q=q->next)
+      qold=q; 
+    if (q==NULL) {   /* end of list */
+      qold->next = p;
+      p->prev = qold;
+      p->next = NULL;
+    }
+    else if (q==evlist) { /* front of list */
+      p->next=evlist;
+      p->prev=NULL;
+      p->next->prev=p;
+      evlist = p;
+    }
+    else {     /* middle of list */
+      p->next=q;
+      p->prev=q->prev;
+      q->prev->next=p;
+      q->prev=p;
+    }
+  }
+  GAUGE_ADD(G_EVENTS, 1);
+  TIME_STOP(T_INSERTEVENT);
+}
+
+/* a new event, created by the entity whose event is being handled */
+struct event *newevent(void)
+{
+  struct event *evptr = emalloc(sizeof(struct event), "event");
+
+  if (npartitions > 0) {
+    evptr->creator = current_entity;
+    evptr->seq = evcount[current_entity]++;
+  }
+  return evptr;
+}
+
+/********************* TRAFFIC SOURCES *******/
+
+/* a uniform draw u as 1 - u, which is in (0,1] and so has a logarithm */
+static double upper(double u)
+{
+  return u < 1.0 ? 1.0 - u : 1.0/RANDMAX;
+}
+
+static double exponential(double u, double mean)
+{
+  return -mean * log(upper(u));
+}
+
+static double pareto(double u, double mean)
+{
+  return mean * (onoffshape - 1) / onoffshape / pow(upper(u), 1.0/onoffshape);
+}
+
+static int fill_uniform(int flow, struct arrivals *a)
+{
+  a->t[0] = simtime + lambda*drawarrival(flow, &a->side[0])*2;  /* uniform on [0,2*lambda] */
+  return 1;                                                     /* having mean of lambda */
+}
+
+static int fill_poisson(int flow, struct arrivals *a)
+{
+  int n;
+
+  for (n=0; n<ARRIVALBATCH; n++) {
+    a->last += exponential(drawarrival(flow, &a->side[n]), lambda);
+    a->t[n] = a->last;
+  }
+  return n;
+}
+
+static int fill_onoff(int flow, struct arrivals *a)
+{
+  double start;
+  int n = 0;
+
+  while (n < ARRIVALBATCH) {
+    if (a->last >= a->onend) {    /* an off period, then the next on period */
+      start = a->onend + pareto(drawperiod(flow), ONOFFPERIOD*lambda);
+      a->onend = start + pareto(drawperiod(flow), ONOFFPERIOD*lambda);
+      a->last = start;
+    }
+    a->last += exponential(drawarrival(flow, &a->side[n]), lambda/2);
+    if (a->last < a->onend)
+      a->t[n++] = a->last;
+  }
+  return n;
+}
+
+static int fill_cbr(int flow, struct arrivals *a)
+{
+  int n;
+
+  (void)flow;                     /* draws no random numbers */
+  for (n=0; n<ARRIVALBATCH; n++) {
+    a->last += lambda;
+    a->t[n] = a->last;
+    a->side[n] = bidirectional && (a->turn++ & 1) ? B : A;
+  }
+  return n;
+}
+
+static int fill_trace(int flow, struct arrivals *a)
+{
+  char line[256], side[2];
+  double t;
+  int n = 0;
+
+  (void)flow;                     /* each flow has a file of its own */
+  while (n < ARRIVALBATCH && fgets(line, sizeof(line), a->trace) != NULL) {
+    side[0] = 'A';
+    if (sscanf(line, "%lf %1s", &t, side) < 1)
+      continue;                   /* blank */
+    if (t > a->last)              /* out of order times come at once */
+      a->last = t;
+    a->t[n] = a->last;
+    a->side[n++] = bidirectional && side[0] == 'B' ? B : A;
+  }
+  a->offset = ftell(a->trace);
+  return n;
+}
+
+static struct source sources[] = {
+  {"uniform", fill_uniform, 0},
+  {"poisson", fill_poisson, 0},
+  {"onoff", fill_onoff, 0},
+  {"cbr", fill_cbr, 0},
+  {"saturate", fill_cbr, 1},
+  {"trace", fill_trace, 0},
+};
+#define NSOURCES  (sizeof(sources) / sizeof(sources[0]))
+
+/* the source named by -n: a name, or onoff:shape or trace:file */
+struct source *findsource(char *arg)
+{
+  char *colon = strchr(arg, ':');
+  size_t len = colon != NULL ? colon - arg : strlen(arg);
+  size_t i;
+
+  for (i=0; i<NSOURCES; i++)
+    if (strlen(sources[i].name) == len && strncmp(arg, sources[i].name, len) == 0)
+      break;
+  if (i == NSOURCES || (colon == NULL && sources[i].fill == fill_trace) ||
+      (colon != NULL && sources[i].fill != fill_trace && sources[i].fill != fill_onoff))
+    return NULL;
+  if (sources[i].fill == fill_trace)
+    tracefile = colon + 1;
+  else if (colon != NULL)
+    onoffshape = atof(colon + 1);
+  return &sources[i];
+}
+
+/* set up each flow's batch of arrivals, empty */
+void opentraffic(void)
+{
+  int i;
+
+  arrivals = emalloc(nflows * sizeof(struct arrivals), "flows");
+  for (i=0; i<nflows; i++) {
+    arrivals[i].next = 0;
+    arrivals[i].count = 0;
+    arrivals[i].last = 0.0;
+    arrivals[i].onend = 0.0;
+    arrivals[i].turn = 0;
+    arrivals[i].trace = NULL;
+    arrivals[i].offset = 0;
+    if (tracefile != NULL && (arrivals[i].trace = fopen(tracefile, "r")) == NULL) {
+      printf("unable to read %s\n", tracefile);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* put each flow's trace back where init() left it.  Runs forked after
+   init() share the open files, and with them where the last run stopped */
+void rewindtraffic(void)
+{
+  int i;
+
+  for (i=0; i<nflows; i++)
+    if (arrivals[i].trace != NULL)
+      fseek(arrivals[i].trace, arrivals[i].offset, SEEK_SET);
+}
+
+/* the time of the next message from layer 5 for a flow, and the side it
+   goes to, or -1.0 once the source has no more */
+double nextarrival(int flow, int *side)
+{
+  struct arrivals *a = &arrivals[flow];
+
+  if (a->next == a->count) {
+    a->next = 0;
+    if ((a->count = traffic->fill(flow, a)) == 0)
+      return -1.0;
+  }
+  *side = a->side[a->next];
+  return a->t[a->next++];
+}
+
+/* the next message from layer 5 for the flow of entity.  The parallel
+   engine sends it to entity itself, at half the rate with -b */
+void generate_next_arrival(int entity)
+{
+  double x;
+  struct event *evptr;
+  int side = A;
+
+  if (TRACE>2)
+    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+
+  if (npartitions > 0)
+    x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  else if ((x = nextarrival(FLOW(entity), &side)) < 0.0)
+    return;                   /* x is the time of the arrival */
+  evptr = newevent();
+  evptr->evtype =  FROM_LAYER5;
+  if (npartitions > 0) {
+    evptr->evtime = simtime + (bidirectional ? 2*x : x);
+    evptr->eventity = entity;
+  }
+  else {
+    evptr->evtime =  x;
+    evptr->eventity = ENTITY(FLOW(entity), side);
+  }
+  insertevent(evptr);
+}
+
+/* the number of the next message layer 5 gives to entity, or -1 once
+   nsimmax have been given.  The parallel engine gives each entity that
+   sends an equal share */
+int nextmessage(int entity)
+{
+  int senders, sender, share;
+
+  if (source != NULL && streamed[entity] >= sourcesize)
+    return -1;
+  if (npartitions == 0)
+    return nsim < nsimmax ? nsim++ : -1;
+  senders = bidirectional ? 2*nflows : nflows;
+  sender = bidirectional ? entity : FLOW(entity);
+  share = nsimmax / senders + (sender < nsimmax % senders);
+  return msgcount[entity] < share ? msgcount[entity]++ : -1;
+}
+
+void printevlist(void)
+{
+  struct event *q;
+  printf("--------------\nEvent List Follows:\n");
+  for(q = evlist; q!=NULL; q=q->next) {
+    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  }
+  printf("--------------\n");
+}
+
+void usage(char *progname)
+{
+  int i;
+
+  printf("usage: %s [-b] [-f nflows] [-l linkservice] [-r reorderprob] [-d reorderdepth] [-u dupprob]\n       [-j jsonfile] [-t csvfile] [-i sampleinterval]\n       [-p partitions] [-s sourcefile [-o sinkfile]] [-w recordfile | -x replayfile]\n       [-k checkpointfile -a time] [-g checkpointfile]\n       [-c precision] [-e seconds] [-m time]\n       [-n uniform|poisson|onoff[:shape]|cbr|saturate|trace:file] [-q readservice]\n       [-y nstreams] [-z lifetime] [-P protocol[,protocol...]]\n", progname);
+  printf("  -b  bidirectional transfer, layer 5 gives messages to both A and B\n");
+  printf("  -f  number of flows (A and B pairs) sharing the medium\n");
+  printf("  -l  time the shared link takes to send one packet, 0 for no limit\n");
+  printf("  -r  select the reordering medium; probability a packet is held back\n");
+  printf("  -d  select the reordering medium; max extra delay of a held back packet\n");
+  printf("  -u  probability that a packet is duplicated by the medium\n");
+  printf("  -j  write the report, message delays and samples to a JSON file\n");
+  printf("  -t  write goodput and window samples to a CSV file\n");
+  printf("  -i  simulated time between samples\n");
+  printf("  -p  run the parallel engine with this many threads; not with -l or samples\n");
+  printf("  -s  layer 5 sends the contents of this file, and checks what is delivered\n");
+  printf("  -o  write the data delivered to B to this file; one flow, A to B only\n");
+  printf("  -w  record the random decisions of the run to this file; not with -p\n");
+  printf("  -x  replay the random decisions recorded in this file; not with -p\n");
+  printf("  -k  write a checkpoint to this file at the time given with -a, and stop\n");
+  printf("  -a  simulated time of the checkpoint\n");
+  printf("  -g  go on from a checkpoint; stdin and the options may differ, the flows not\n");
+  printf("  -c  stop once goodput and delay are known to this relative precision, at 95%%\n");
+  printf("  -e  stop after this many seconds of wall-clock time\n");
+  printf("  -m  stop after this much simulated time\n");
+  printf("      (-c, -e and -m are not with -p)\n");
+  printf("  -n  traffic source for layer 5, lambda apart on average; not with -p\n");
+  printf("  -q  time the receiving application takes to read one message, 0 for none\n");
+  printf("  -y  layer 5 sends message n on stream n %% nstreams; not with -p or -s\n");
+  printf("  -z  a message not delivered this long after it was sent may be given up on;\n");
+  printf("      not with -s\n");
+  printf("  -P  the protocols to run, each in turn from the same start and over the\n");
+  printf("      same channel, of:");
+  for (i=0; protocols[i] != NULL; i++)
+    printf(" %s", protocols[i]->name);
+  printf("\n      more than one not with -j, -t, -o, -w, -k or -g\n");
+  exit(EXIT_FAILURE);
+}
+
+/* the protocols named by -P, separated by commas; 0 if one is not linked in */
+int chooseprotocols(char *arg)
+{
+  const struct protocol **chosen;
+  char *name;
+  int n = 1;
+
+  for (name = arg; *name != '\0'; name++)
+    n += *name == ',';
+  chosen = emalloc(n * sizeof(*chosen), "protocols");
+  runs = chosen;
+  nruns = 0;
+  for (name = strtok(arg, ","); name != NULL; name = strtok(NULL, ","))
+    if ((chosen[nruns++] = findprotocol(name)) == NULL)
+      return 0;
+  return nruns > 0;
+}
+
+void parseargs(int argc, char **argv)   /* read the command line options */
+{
+  int c, i;
+
+  while ((c = getopt(argc, argv, "bf:l:r:d:u:j:t:i:p:s:o:w:x:k:a:g:c:e:m:n:q:y:z:P:")) != -1) {
+    switch (c) {
+    case 'b':
+      bidirectional = 1;
+      break;
+    case 'f':
+      nflows = atoi(optarg);
+      break;
+    case 'l':
+      linkservice = atof(optarg);
+      break;
+    case 'r':
+      reorder = 1;
+      reorderprob = atof(optarg);
+      break;
+    case 'd':
+      reorder = 1;
+      reorderdepth = atof(optarg);
+      break;
+    case 'u':
+      dupprob = atof(optarg);
+      break;
+    case 'j':
+      jsonfile = optarg;
+      break;
+    case 't':
+      csvfile = optarg;
+      break;
+    case 'i':
+      sampleinterval = atof(optarg);
+      break;
+    case 'p':
+      npartitions = atoi(optarg);
+      break;
+    case 's':
+      sourcefile = optarg;
+      break;
+    case 'o':
+      sinkfile = optarg;
+      break;
+    case 'w':
+      recordfile = optarg;
+      break;
+    case 'x':
+      replayfile = optarg;
+      break;
+    case 'k':
+      checkpointfile = optarg;
+      break;
+    case 'a':
+      checkpointtime = atof(optarg);
+      break;
+    case 'g':
+      resumefile = optarg;
+      break;
+    case 'c':
+      precision = atof(optarg);
+      break;
+    case 'e':
+      wallbudget = atof(optarg);
+      break;
+    case 'm':
+      timebudget = atof(optarg);
+      break;
+    case 'n':
+      if ((traffic = findsource(optarg)) == NULL)
+        usage(argv[0]);
+      break;
+    case 'q':
+      readservice = atof(optarg);
+      break;
+    case 'y':
+      nstreams = atoi(optarg);
+      break;
+    case 'z':
+      lifetime = atof(optarg);
+      break;
+    case 'P':
+      if (!chooseprotocols(optarg))
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind < argc || nflows < 1 || linkservice < 0.0 || sampleinterval <= 0.0 || reorderprob < 0.0 || reorderprob > 1.0 ||
+      reorderdepth < 0.0 || dupprob < 0.0 || dupprob > 1.0 || npartitions < 0 ||
+      (npartitions > 0 && (linkservice > 0.0 || csvfile != NULL)) ||
+      (sinkfile != NULL && (sourcefile == NULL || nflows > 1 || bidirectional)) ||
+      (recordfile != NULL && replayfile != NULL) ||
+      (npartitions > 0 && (recordfile != NULL || replayfile != NULL)) ||
+      ((checkpointfile != NULL || resumefile != NULL) &&
+       (npartitions > 0 || recordfile != NULL || replayfile != NULL)) ||
+      precision < 0.0 || wallbudget < 0.0 || timebudget < 0.0 || readservice < 0.0 ||
+      nstreams < 1 || (nstreams > 1 && (npartitions > 0 || sourcefile != NULL)) ||
+      lifetime < 0.0 || (lifetime > 0.0 && sourcefile != NULL) ||
+      (nruns > 1 && (jsonfile != NULL || csvfile != NULL || sinkfile != NULL ||
+                     recordfile != NULL || checkpointfile != NULL || resumefile != NULL)))
+    usage(argv[0]);
+  batching = precision > 0.0 || wallbudget > 0.0 || timebudget > 0.0;
+  if ((batching || traffic != NULL) && npartitions > 0)
+    usage(argv[0]);
+  if (traffic == NULL)
+    traffic = &sources[0];
+  if (onoffshape <= 1.0)          /* the mean period would be infinite */
+    usage(argv[0]);
+  for (i=0; i<nruns; i++)
+    if (runs[i]->maxflows > 0 && nflows > runs[i]->maxflows) {
+      printf("%s is limited to -f %d\n", runs[i]->name, runs[i]->maxflows);
+      exit(EXIT_FAILURE);
+    }
+    else if (nstreams > 1 && !runs[i]->streams) {
+      printf("%s does not keep the stream of a message, so not -y\n", runs[i]->name);
+      exit(EXIT_FAILURE);
+    }
+    else if (readservice > 0.0 && !runs[i]->flowcontrol) {
+      printf("%s does not ask layer 5 for room, so not -q\n", runs[i]->name);
+      exit(EXIT_FAILURE);
+    }
+    else if (bidirectional && !runs[i]->duplex) {
+      printf("%s only sends from A to B, so not -b\n", runs[i]->name);
+      exit(EXIT_FAILURE);
+    }
+}
+
+/********************** LAYER 5 DATA ***********************/
+
+/* map the source file, and the sink file at the same size */
+void openstreams(void)
+{
+  struct stat st;
+  int fd, i;
+
+  if ((fd = open(sourcefile, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+    printf("unable to read %s\n", sourcefile);
+    exit(EXIT_FAILURE);
+  }
+  sourcesize = st.st_size;
+  source = "";
+  if (sourcesize > 0 && (source = mmap(NULL, sourcesize, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    printf("unable to map %s\n", sourcefile);
+    exit(EXIT_FAILURE);
+  }
+  close(fd);
+  madvise(source, sourcesize, MADV_SEQUENTIAL);
+
+  if (sinkfile != NULL) {
+    if ((sinkfd = open(sinkfile, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0
+        || ftruncate(sinkfd, sourcesize) < 0) {
+      printf("unable to write %s\n", sinkfile);
+      exit(EXIT_FAILURE);
+    }
+    if (sourcesize > 0 && (sink = mmap(NULL, sourcesize, PROT_READ | PROT_WRITE, MAP_SHARED, sinkfd, 0)) == MAP_FAILED) {
+      printf("unable to map %s\n", sinkfile);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  streamed = emalloc(2*nflows * sizeof(long), "streams");
+  received = emalloc(2*nflows * sizeof(long), "streams");
+  firstbad = emalloc(2*nflows * sizeof(long), "streams");
+  for (i=0; i<2*nflows; i++) {
+    streamed[i] = 0;
+    received[i] = 0;
+    firstbad[i] = -1;
+  }
+}
+
+/* the next message layer 5 gives to entity, message n of the run */
+void fillmessage(int entity, int n, struct msg *m)
+{
+  long left;
+  int i;
+
+  m->stream = n % nstreams;
+  m->deadline = lifetime > 0.0 ? simtime + lifetime : 0.0;
+  if (source == NULL) {
+    for (i=0; i<20; i++)      /* a string of the same letter */
+      m->data[i] = 97 + n % 26;
+    return;
+  }
+  left = sourcesize - streamed[entity];
+  memcpy(m->data, source + streamed[entity], left < 20 ? left : 20);
+  if (left < 20)
+    memset(m->data + left, 0, 20 - left);
+}
+
+/* layer 5 of entity has given the message to the transport, which
+   accepted it: the next one starts 20 bytes on */
+void streamaccepted(int entity)
+{
+  if (source != NULL)
+    streamed[entity] += 20;
+}
+
+/* check a message delivered to entity against the file, and write it out */
+void streamdelivered(int entity, char data[20])
+{
+  long at = received[entity];
+  long n = sourcesize - at;
+
+  if (n > 20)
+    n = 20;
+  /* wrong, or more than was sent */
+  if ((n <= 0 || memcmp(data, source + at, n) != 0) && firstbad[entity] < 0)
+    firstbad[entity] = at;
+  if (n > 0 && sink != NULL && entity == ENTITY(0, B))
+    memcpy(sink + at, data, n);
+  received[entity] = at + 20;
+}
+
+/* report whether every receiving entity was given exactly what its peer
+   accepted, and finish the sink file; 0 if not */
+int checkstreams(void)
+{
+  long bytes = 0;
+  int i, ok = 1;
+
+  for (i=0; i<2*nflows; i++) {
+    if (SIDE(i) == A || bidirectional)
+      bytes += streamed[i] < sourcesize ? streamed[i] : sourcesize;
+    if (firstbad[i] >= 0) {
+      printf("data delivered to %c of flow %d differs from %s at byte %ld \n",
+             'A' + SIDE(i), FLOW(i), sourcefile, firstbad[i]);
+      ok = 0;
+    }
+    else if (received[i] != streamed[ENTITY(FLOW(i), (SIDE(i)+1) % 2)]) {
+      printf("%c of flow %d was given %ld of the %ld bytes accepted for it \n",
+             'A' + SIDE(i), FLOW(i), received[i], streamed[ENTITY(FLOW(i), (SIDE(i)+1) % 2)]);
+      ok = 0;
+    }
+  }
+  if (ok)
+    printf("data delivered matches %s:  %ld bytes \n", sourcefile, bytes);
+  streambytes = bytes;
+  streamok = ok;
+  if (sink != NULL) {
+    munmap(sink, sourcesize);
+    if (ftruncate(sinkfd, received[ENTITY(0, B)] < sourcesize ? received[ENTITY(0, B)] : sourcesize) < 0)
+      printf("unable to write %s\n", sinkfile);
+    close(sinkfd);
+  }
+  return ok;
+}
+
+void init(void)                         /* initialize the simulator */
+{
+  float sum, avg;
+  int i;
+
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+
+
+  initstate(9999, randstate[randcurrent], RANDSTATE);  /* init random number generator */
+  sum = 0.0;                /* test random number generator for students */
+  for (i=0; i<1000; i++)
+    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
+  avg = sum/1000.0;
+  if (avg < 0.25 || avg > 0.75) {
+    printf("It is likely that random number generation on your machine\n" ); 
+    printf("is different from what this emulator expects.  Please take\n");
+    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+    exit(EXIT_FAILURE);
+  }
+
+  /* initialise statistics */
+  stats_init();
+  linkfree[A] = 0.0;
+  linkfree[B] = 0.0;
+
+  delivered = emalloc(2*nflows * sizeof(int), "flows");
+  timers = emalloc(NTIMERS * 2*nflows * sizeof(struct event *), "flows");
+  lastarrival = emalloc(2*nflows * sizeof(double), "flows");
+  unacked = emalloc(2*nflows * nstreams * sizeof(struct sendtimes), "flows");
+  readfree = emalloc(2*nflows * sizeof(double), "flows");
+  readwait = emalloc(2*nflows * sizeof(int), "flows");
+  for (i=0; i<NTIMERS * 2*nflows; i++)
+    timers[i] = NULL;
+  for (i=0; i<2*nflows; i++) {
+    delivered[i] = 0;
+    lastarrival[i] = 0.0;
+    readfree[i] = 0.0;
+    readwait[i] = 0;
+  }
+  for (i=0; i<2*nflows * nstreams; i++) {
+    unacked[i].head = NULL;
+    unacked[i].tail = NULL;
+    unacked[i].taken = 0;
+    atomic_init(&unacked[i].added, 0);
+  }
+  if (nruns > 1) {
+    drawstreams = emalloc(NSTREAMS * sizeof(*drawstreams), "streams");
+    for (i=0; i<NSTREAMS; i++) {
+      drawstreams[i][0] = 0x330e;    /* as srand48() would, seeded by the stream */
+      drawstreams[i][1] = (9999 + 7919*i) & 0xffff;
+      drawstreams[i][2] = ((9999 + 7919*i) >> 16) & 0xffff;
+    }
+  }
+  opentraffic();
+  if (sourcefile != NULL)
+    openstreams();
+  if (recordfile != NULL)
+    replay_record(recordfile, NSTREAMS);
+  if (replayfile != NULL)
+    replay_open(replayfile, NSTREAMS);
+  hist_init(&latency[A]);
+  hist_init(&latency[B]);
+  hist_init(&queueing);
+  streamlatency = emalloc(nstreams * sizeof(struct histogram), "streams");
+  for (i=0; i<nstreams; i++)
+    hist_init(&streamlatency[i]);
+  nextsample = sampleinterval;
+  lastdelivered = 0;
+  samples = NULL;
+  nsamples = 0;
+  samplesize = 0;
+
+  simtime=0.0;                    /* initialize time to 0.0 */
+  if (resumefile != NULL)
+    return;                       /* the event list is in the checkpoint */
+  if (npartitions == 0) {
+    for (i=0; i<nflows; i++)
+      generate_next_arrival(ENTITY(i, A));  /* initialize event list */
+    return;
+  }
+
+  partitions = emalloc(npartitions * sizeof(struct partition), "partitions");
+  streams = emalloc(2*nflows * sizeof(*streams), "partitions");
+  evcount = emalloc(2*nflows * sizeof(long), "partitions");
+  msgcount = emalloc(2*nflows * sizeof(int), "partitions");
+  for (i=0; i<npartitions; i++)
+    atomic_init(&partitions[i].mailbox, NULL);
+  for (i=0; i<2*nflows; i++) {
+    streams[i][0] = 0x330e;    /* as srand48() would, seeded by the entity */
+    streams[i][1] = (9999 + 7919*i) & 0xffff;
+    streams[i][2] = ((9999 + 7919*i) >> 16) & 0xffff;
+    evcount[i] = 0;
+    msgcount[i] = 0;
+  }
+  for (current_entity=0; current_entity<2*nflows; current_entity++)
+    if (SIDE(current_entity) == A || bidirectional)
+      generate_next_arrival(current_entity);
+}
+
+/* the slot in timers[] for a timer of the given event type */
+struct event **timerslot(int evtype, int entity)
+{
+  if (evtype == ACK_TIMER)
+    return &timers[2*nflows + entity];
+  if (evtype == PACE_TIMER)
+    return &timers[2 * 2*nflows + entity];
+  return &timers[entity];
+}
+
+/* unlink an event from the event list */
+void removeevent(struct event *q)
+{
+  if (q->next==NULL && q->prev==NULL)
+    evlist=NULL;         /* remove first and only event on list */
+  else if (q->next==NULL) /* end of list - there is one in front */
+    q->prev->next = NULL;
+  else if (q==evlist) { /* front of list - there must be event after */
+    q->next->prev=NULL;
+    evlist = q->next;
+  }
+  else {     /* middle of list */
+    q->next->prev = q->prev;
+    q->prev->next =  q->next;
+  }
+  GAUGE_ADD(G_EVENTS, -1);
+}
+
+/* cancel a previously-started timer of the given event type */
+void stopevtimer(int evtype, int AorB)
+{
+  struct event **slot = timerslot(evtype, ENTITY(current_flow, AorB));
+
+  if (*slot == NULL) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  removeevent(*slot);
+  efree(*slot);
+  *slot = NULL;
+}
+
+/* start a timer of the given event type */
+void startevtimer(int evtype, int AorB, double increment)
+{
+  struct event **slot = timerslot(evtype, ENTITY(current_flow, AorB));
+  struct event *evptr;
+
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (*slot != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+ 
+  /* create future event for when timer goes off */
+  evptr = newevent();
+  evptr->evtime =  simtime + increment;
+  evptr->evtype =  evtype;
+  evptr->eventity = ENTITY(current_flow, AorB);
+  insertevent(evptr);
+  *slot = evptr;
+} 
+
+/********************** Student-callable ROUTINES ***********************/
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(int AorB)
+/* A or B is trying to stop timer */
+{
+  if (TRACE>1)
+    printf("          STOP TIMER: stopping timer at %f\n",simtime);
+  stopevtimer(TIMER_INTERRUPT, AorB);
+}
+
+
+void starttimer(int AorB, double increment)
+/* A or B is trying to start timer */
+{
+  if (TRACE>1)
+    printf("          START TIMER: starting timer at %f\n",simtime);
+  startevtimer(TIMER_INTERRUPT, AorB, increment);
+} 
+
+/* the delayed ACK timer works like the timer above, but is separate from it
+   so an entity can hold back an ACK while its retransmission timer runs */
+void stopacktimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP ACK TIMER: stopping ack timer at %f\n",simtime);
+  stopevtimer(ACK_TIMER, AorB);
+}
+
+void startacktimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START ACK TIMER: starting ack timer at %f\n",simtime);
+  startevtimer(ACK_TIMER, AorB, increment);
+}
+
+/* the pacing timer lets a sender space out its packets */
+void stoppacetimer(int AorB)
+{
+  if (TRACE>1)
+    printf("          STOP PACE TIMER: stopping pace timer at %f\n",simtime);
+  stopevtimer(PACE_TIMER, AorB);
+}
+
+void startpacetimer(int AorB, double increment)
+{
+  if (TRACE>1)
+    printf("          START PACE TIMER: starting pace timer at %f\n",simtime);
+  startevtimer(PACE_TIMER, AorB, increment);
+}
+
+
+/************************** TOLAYER3 ***************/
+
+/* compute the arrival time of a packet at an entity and put it on the
+   event list.  The packet first waits for its turn on the shared link, if
+   one is configured.  With the FIFO medium it then arrives between 1 and
+   10 time units after the latest arrival time of packets of the same flow
+   currently in the medium on their way to the destination.  With the
+   reordering medium every packet gets an independent delay, and some are
+   held back further.  The draws for this copy of the packet are in f.  */
+void schedule_arrival(int entity, struct pkt *pktptr, struct fate *f, int copy)
+{
+  struct event *evptr;
+  double lastime, sent;
+
+  evptr = newevent();
+  evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
+  evptr->eventity = entity;
+  evptr->pktptr = pktptr;         /* save ptr to my copy of packet */
+  sent = simtime;
+  if (linkservice > 0.0) {
+    if (linkfree[SIDE(entity)] > sent)
+      sent = linkfree[SIDE(entity)];
+    sent += linkservice;
+    linkfree[SIDE(entity)] = sent;
+  }
+  if (reorder) {
+    hist_record(&queueing, sent - simtime);
+    evptr->evtime = sent + 1 + 9*f->delay[copy];
+    if (f->held[copy]) {
+      COUNT((SIDE(entity)+1) % 2, C_REORDERED);
+      evptr->evtime += reorderdepth*f->depth[copy];
+      if (TRACE>0)
+        printf("          TOLAYER3: packet being held back\n");
+    }
+  }
+  else {
+    /* lastarrival[] is the evtime of the last FROM_LAYER3 event on the
+       list for this entity, so there is no need to search the list */
+    lastime = sent;
+    if (lastarrival[entity] > lastime)
+      lastime = lastarrival[entity];
+    hist_record(&queueing, lastime - simtime);
+    evptr->evtime =  lastime + 1 + 9*f->delay[copy];
+    lastarrival[entity] = evptr->evtime;
+  }
+  GAUGE_ADD(G_INMEDIUM, 1);
+  insertevent(evptr);
+  if (bursting && (npartitions == 0 || PART(entity) == mypartition))
+    burst = evptr;
+}
+
+void sendtolayer3(int AorB, struct pkt packet)
+{
+  struct pkt *mypktptr, *duppktptr;
+  struct fate fate;
+  int i;
+
+  if (packet.connid < 0 || packet.connid >= nflows) {
+    printf("Warning: packet for unknown connection %d not sent.\n", packet.connid);
+    return;
+  }
+  COUNT(AorB, C_TOLAYER3);
+  getfate(ENTITY(packet.connid, AorB), &fate);
+
+  /* simulate losses: */
+  if (fate.lost) {
+    COUNT(AorB, C_LOST);
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }  
+
+  /* make a copy of the packet student just gave me since he/she may decide */
+  /* to do something with the packet after we return back to him/her */ 
+  mypktptr = emalloc(sizeof(struct pkt), "event");
+  *mypktptr = packet;
+  if (TRACE>2)  {
+    printf("          TOLAYER3: conn: %d, seq: %d, ack %d, check: %d ", mypktptr->connid,
+           mypktptr->seqnum, mypktptr->acknum,  mypktptr->checksum);
+    for (i=0; i<20; i++)
+      printf("%c",mypktptr->payload[i]);
+    printf("\n");
+  }
+
+  /* create future event for arrival of packet at the other side */
+  if (TRACE>2)  
+    printf("          TOLAYER3: scheduling arrival on other side\n");
+  schedule_arrival(ENTITY(packet.connid, (AorB+1) % 2), mypktptr, &fate, 0);
+
+  /* simulate corruption: */
+  if (fate.corrupt) {
+    COUNT(AorB, C_CORRUPTED);
+    if (fate.corrupt == 1)
+      mypktptr->payload[0]='Z';   /* corrupt payload */
+    else if (fate.corrupt == 2)
+      mypktptr->seqnum = 999999;
+    else
+      mypktptr->acknum = 999999;
+    if (TRACE>0)    
+      printf("          TOLAYER3: packet being corrupted\n");
+  }  
+
+  /* simulate duplication: the copy travels independently */
+  if (fate.copies == 2) {
+    COUNT(AorB, C_DUPLICATED);
+    duppktptr = emalloc(sizeof(struct pkt), "event");
+    *duppktptr = *mypktptr;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being duplicated\n");
+    schedule_arrival(ENTITY(packet.connid, (AorB+1) % 2), duppktptr, &fate, 1);
+  }
+} 
+
+void tolayer3(int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  TIME_START(T_TOLAYER3);
+  sendtolayer3(AorB, packet);
+  TIME_STOP(T_TOLAYER3);
+}
+
+/* A or B is sending n packets to network, one after the other.  The
+   fates are drawn in the same order as n calls of tolayer3 would draw
+   them, and each arrival is searched for on the event list from the last */
+void tolayer3_batch(int AorB, struct pkt *packets, int n)
+{
+  int i;
+
+  TIME_START(T_TOLAYER3);
+  bursting = 1;
+  for (i=0; i<n; i++)
+    sendtolayer3(AorB, packets[i]);
+  bursting = 0;
+  burst = NULL;
+  TIME_STOP(T_TOLAYER3);
+}
+
+/********************** MESSAGE DELAY AND SAMPLES ***********************/
+
+/* add a send time to the end of a queue */
+void addsendtime(struct sendtimes *q, double t)
+{
+  long added = atomic_load_explicit(&q->added, memory_order_relaxed);
+  struct sendchunk *c;
+
+  if (q->tail == NULL || added % SENDCHUNK == 0) {
+    c = emalloc(sizeof(struct sendchunk), "send times");
+    c->next = NULL;
+    if (q->tail == NULL)
+      q->head = c;
+    else
+      q->tail->next = c;
+    q->tail = c;
+  }
+  q->tail->t[added % SENDCHUNK] = t;
+  /* publish the time, and any new chunk, to the receiver */
+  atomic_store_explicit(&q->added, added + 1, memory_order_release);
+}
+
+/* remember when layer 5 gave a message to an entity that accepted it.
+   Each stream is delivered in order, so the times are kept by stream */
+void recordsend(int entity, int stream)
+{
+  addsendtime(&unacked[SENDQUEUE(entity, stream)], simtime);
+  GAUGE_ADD(G_OUTSTANDING, 1);
+}
+
+/* take the send time of the oldest message of the stream entity sent
+   that is still to be delivered; whether there was one */
+static int takesendtime(int entity, int stream, double *t)
+{
+  struct sendtimes *q = &unacked[SENDQUEUE(entity, stream)];
+  struct sendchunk *c;
+
+  if (q->taken == atomic_load_explicit(&q->added, memory_order_acquire))
+    return 0;
+  if (q->taken % SENDCHUNK == 0 && q->taken > 0) {
+    c = q->head;
+    q->head = c->next;
+    efree(c);
+  }
+  *t = q->head->t[q->taken % SENDCHUNK];
+  q->taken++;
+  GAUGE_ADD(G_OUTSTANDING, -1);
+  return 1;
+}
+
+/* a message sent by entity has been delivered, record how long it took */
+void recorddelivery(int entity, int stream)
+{
+  double sent;
+
+  if (!takesendtime(entity, stream, &sent))
+    return;             /* delivered more than once */
+  hist_record(&latency[SIDE(entity)], simtime - sent);
+  if (nstreams > 1)
+    hist_record(&streamlatency[stream], simtime - sent);
+  if (batching)
+    batch_record(&delaybatches, simtime - sent);
+}
+
+/********************** CHECKPOINTS ***********************/
+
+/* changed with every change to what a checkpoint holds, so that one
+   written by an older emulator is refused rather than misread */
+#define CHECKPOINTMAGIC "SRCKPT07"
+
+static void put(FILE *f, void *p, size_t size)
+{
+  if (size > 0 && fwrite(p, size, 1, f) != 1) {
+    printf("unable to write the checkpoint %s\n", checkpointfile);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void get(FILE *f, void *p, size_t size)
+{
+  if (size > 0 && fread(p, size, 1, f) != 1) {
+    printf("the checkpoint %s is incomplete\n", resumefile);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* write the state of the run to checkpointfile: the emulator's, the
+   random number generator's and the protocol's */
+void savecheckpoint(void)
+{
+  struct statsnapshot stats;
+  struct sendtimes *q;
+  struct sendchunk *c;
+  struct event *e;
+  FILE *f;
+  long k, added, n;
+  int i, hasstream = source != NULL;
+
+  if ((f = fopen(checkpointfile, "wb")) == NULL) {
+    printf("unable to write the checkpoint %s\n", checkpointfile);
+    exit(EXIT_FAILURE);
+  }
+  put(f, CHECKPOINTMAGIC, sizeof(CHECKPOINTMAGIC) - 1);
+  put(f, &nflows, sizeof(nflows));
+  put(f, &nstreams, sizeof(nstreams));
+  put(f, &simtime, sizeof(simtime));
+  put(f, &nsim, sizeof(nsim));
+  setstate(randstate[randcurrent]);   /* brings the state in the buffer up to date */
+  put(f, randstate[randcurrent], RANDSTATE);
+  stats_save(&stats);
+  put(f, &stats, sizeof(stats));
+  put(f, latency, sizeof(latency));
+  put(f, &queueing, sizeof(queueing));
+  put(f, streamlatency, nstreams * sizeof(struct histogram));
+  put(f, linkfree, sizeof(linkfree));
+  put(f, lastarrival, 2*nflows * sizeof(double));
+  put(f, readfree, 2*nflows * sizeof(double));
+  put(f, delivered, 2*nflows * sizeof(int));
+  put(f, &nextsample, sizeof(nextsample));
+  put(f, &lastdelivered, sizeof(lastdelivered));
+  put(f, &nsamples, sizeof(nsamples));
+  put(f, samples, nsamples * sizeof(struct sample));
+  put(f, &hasstream, sizeof(hasstream));
+  if (hasstream) {
+    put(f, streamed, 2*nflows * sizeof(long));
+    put(f, received, 2*nflows * sizeof(long));
+    put(f, firstbad, 2*nflows * sizeof(long));
+  }
+  put(f, arrivals, nflows * sizeof(struct arrivals));
+
+  /* the send times of the messages not yet delivered, oldest first */
+  for (i=0; i<2*nflows * nstreams; i++) {
+    q = &unacked[i];
+    added = atomic_load_explicit(&q->added, memory_order_relaxed);
+    n = added - q->taken;
+    put(f, &n, sizeof(n));
+    c = q->head;
+    if (q->taken % SENDCHUNK == 0 && q->taken > 0)
+      c = c->next;                  /* the head is used up, but not yet freed */
+    for (k=q->taken; k<added; k++) {
+      if (k % SENDCHUNK == 0 && k != q->taken)
+        c = c->next;
+      put(f, &c->t[k % SENDCHUNK], sizeof(double));
+    }
+  }
+
+  for (n=0, e=evlist; e!=NULL; e=e->next)
+    n++;
+  put(f, &n, sizeof(n));
+  for (e=evlist; e!=NULL; e=e->next) {
+    put(f, &e->evtime, sizeof(e->evtime));
+    put(f, &e->evtype, sizeof(e->evtype));
+    put(f, &e->eventity, sizeof(e->eventity));
+    if (e->evtype == FROM_LAYER3)
+      put(f, e->pktptr, sizeof(struct pkt));
+  }
+
+  protocol->save(f);
+  if (fclose(f) != 0) {
+    printf("unable to write the checkpoint %s\n", checkpointfile);
+    exit(EXIT_FAILURE);
+  }
+  printf("checkpoint written to %s at time %f \n", checkpointfile, simtime);
+}
+
+/* read back the state savecheckpoint() wrote to resumefile */
+void restorecheckpoint(void)
+{
+  char magic[sizeof(CHECKPOINTMAGIC) - 1];
+  struct statsnapshot stats;
+  struct event *e, *last = NULL;
+  FILE *f, *trace;
+  long k, n;
+  double t;
+  int i, flows, streams, hasstream;
+
+  if ((f = fopen(resumefile, "rb")) == NULL) {
+    printf("unable to read the checkpoint %s\n", resumefile);
+    exit(EXIT_FAILURE);
+  }
+  get(f, magic, sizeof(magic));
+  get(f, &flows, sizeof(flows));
+  get(f, &streams, sizeof(streams));
+  if (memcmp(magic, CHECKPOINTMAGIC, sizeof(magic)) != 0 || flows != nflows || streams != nstreams) {
+    printf("%s is not a checkpoint of a run with %d flows and %d streams\n", resumefile, nflows, nstreams);
+    exit(EXIT_FAILURE);
+  }
+  get(f, &simtime, sizeof(simtime));
+  get(f, &nsim, sizeof(nsim));
+  /* setstate() writes to the state it leaves, so read into the spare */
+  get(f, randstate[1 - randcurrent], RANDSTATE);
+  randcurrent = 1 - randcurrent;
+  setstate(randstate[randcurrent]);
+  get(f, &stats, sizeof(stats));
+  get(f, latency, sizeof(latency));
+  get(f, &queueing, sizeof(queueing));
+  get(f, streamlatency, nstreams * sizeof(struct histogram));
+  get(f, linkfree, sizeof(linkfree));
+  get(f, lastarrival, 2*nflows * sizeof(double));
+  get(f, readfree, 2*nflows * sizeof(double));
+  get(f, delivered, 2*nflows * sizeof(int));
+  get(f, &nextsample, sizeof(nextsample));
+  get(f, &lastdelivered, sizeof(lastdelivered));
+  get(f, &nsamples, sizeof(nsamples));
+  samplesize = nsamples;
+  samples = nsamples > 0 ? emalloc(nsamples * sizeof(struct sample), "samples") : NULL;
+  get(f, samples, nsamples * sizeof(struct sample));
+  get(f, &hasstream, sizeof(hasstream));
+  if (hasstream != (source != NULL)) {
+    printf("the checkpoint %s was %s layer 5 data from a file, and so must this run be\n",
+           resumefile, hasstream ? "sending" : "not sending");
+    exit(EXIT_FAILURE);
+  }
+  if (hasstream) {
+    get(f, streamed, 2*nflows * sizeof(long));
+    get(f, received, 2*nflows * sizeof(long));
+    get(f, firstbad, 2*nflows * sizeof(long));
+  }
+  for (i=0; i<nflows; i++) {      /* keep this run's trace files */
+    trace = arrivals[i].trace;
+    get(f, &arrivals[i], sizeof(struct arrivals));
+    arrivals[i].trace = trace;
+    if (trace != NULL)
+      fseek(trace, arrivals[i].offset, SEEK_SET);
+  }
+
+  for (i=0; i<2*nflows * nstreams; i++) {
+    get(f, &n, sizeof(n));
+    for (k=0; k<n; k++) {
+      get(f, &t, sizeof(t));
+      addsendtime(&unacked[i], t);
+    }
+  }
+
+  /* the list was written in order, so each event goes on the end */
+  get(f, &n, sizeof(n));
+  for (k=0; k<n; k++) {
+    e = emalloc(sizeof(struct event), "event");
+    get(f, &e->evtime, sizeof(e->evtime));
+    get(f, &e->evtype, sizeof(e->evtype));
+    get(f, &e->eventity, sizeof(e->eventity));
+    e->pktptr = NULL;
+    if (e->evtype == FROM_LAYER3) {
+      e->pktptr = emalloc(sizeof(struct pkt), "event");
+      get(f, e->pktptr, sizeof(struct pkt));
+    }
+    else if (e->evtype == TIMER_INTERRUPT || e->evtype == ACK_TIMER || e->evtype == PACE_TIMER)
+      *timerslot(e->evtype, e->eventity) = e;
+    else if (e->evtype == LAYER5_READY)
+      readwait[e->eventity] = 1;
+    e->prev = last;
+    e->next = NULL;
+    if (last == NULL)
+      evlist = e;
+    else
+      last->next = e;
+    last = e;
+  }
+
+  if (!protocol->restore(f)) {
+    printf("the checkpoint %s was written by another protocol, or another window size\n", resumefile);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  stats_load(&stats);
+}
+
+/* take the samples due up to time t */
+void takesamples(double t)
+{
+  struct sample *p;
+  long delivered;
+
+  while (nextsample <= t) {
+    if (nsamples == samplesize) {
+      samplesize = samplesize ? 2*samplesize : 256;
+      p = realloc(samples, samplesize * sizeof(struct sample));
+      if (p == 0) {
+        printf("memory allocation for samples failed.");
+        exit(EXIT_FAILURE);
+      }
+      samples = p;
+    }
+    delivered = counters[A][C_MESSAGES_DELIVERED] + counters[B][C_MESSAGES_DELIVERED];
+    samples[nsamples].time = nextsample;
+    samples[nsamples].delivered = delivered - lastdelivered;
+    samples[nsamples].outstanding = gauges[G_OUTSTANDING].value;
+    samples[nsamples].inmedium = gauges[G_INMEDIUM].value;
+    nsamples++;
+    lastdelivered = delivered;
+    nextsample += sampleinterval;
+  }
+}
+
+/********************** EARLY TERMINATION ***********************/
+
+/* open the first batches, from now */
+void startbatches(void)
+{
+  batch_init(&goodputbatches, 1, 10*lambda);
+  batch_init(&delaybatches, 0, 10*lambda);
+  batchstart = simtime;
+  batchend = batchstart + goodputbatches.length;
+}
+
+static int precise(struct batchmeans *b)
+{
+  double mean, halfwidth;
+
+  return batch_interval(b, &mean, &halfwidth) && halfwidth <= precision * mean;
+}
+
+/* whether to stop before handling an event at time t, closing the
+   batches that end before it.  The wall clock is read every 1024 events */
+int stopearly(double t)
+{
+  int closed = 0;
+
+  while (batchend <= t) {
+    batch_close(&goodputbatches);
+    batch_close(&delaybatches);
+    batchend = batchstart + (goodputbatches.closed + 1) * goodputbatches.length;
+    closed = 1;
+  }
+  if (timebudget > 0.0 && t > timebudget)
+    stopreason = "simulated time budget used up";
+  else if (wallbudget > 0.0 && run.events % 1024 == 0 && run_elapsed() > wallbudget)
+    stopreason = "wall-clock budget used up";
+  else if (precision > 0.0 && closed && precise(&goodputbatches) && precise(&delaybatches))
+    stopreason = "precision reached";
+  return stopreason != NULL;
+}
+
+void printinterval(char *what, struct batchmeans *b)
+{
+  double mean, halfwidth;
+  int n;
+
+  if ((n = batch_interval(b, &mean, &halfwidth)) == 0)
+    printf("%s 95%% confidence interval:  too few batches (%d) \n", what, b->closed);
+  else
+    printf("%s 95%% confidence interval:  %f +- %f (%.2f%%) over %d batches of %f time units \n",
+           what, mean, halfwidth, mean > 0.0 ? 100.0 * halfwidth / mean : 0.0, n, b->length);
+}
+
+void printinterval_json(FILE *f, struct batchmeans *b)
+{
+  double mean, halfwidth;
+  int n;
+
+  if ((n = batch_interval(b, &mean, &halfwidth)) == 0)
+    fprintf(f, "{\"batches\": %d, \"mean\": null, \"halfwidth\": null}", b->closed);
+  else
+    fprintf(f, "{\"batches\": %d, \"mean\": %f, \"halfwidth\": %f}", n, mean, halfwidth);
+}
+
+/********************** REPORT ***********************/
+
+void writecsv(void)
+{
+  FILE *f;
+  int i;
+
+  if ((f = fopen(csvfile, "w")) == NULL) {
+    printf("unable to write %s\n", csvfile);
+    return;
+  }
+  fprintf(f, "time,goodput,outstanding,inmedium\n");
+  for (i=0; i<nsamples; i++)
+    fprintf(f, "%f,%f,%ld,%ld\n", samples[i].time, samples[i].delivered / sampleinterval,
+            samples[i].outstanding, samples[i].inmedium);
+  fclose(f);
+}
+
+/* messages delivered per time unit, both ways and over all flows */
+double goodput(void)
+{
+  return simtime > 0.0 ? (counters[A][C_MESSAGES_DELIVERED] + counters[B][C_MESSAGES_DELIVERED]) / simtime : 0.0;
+}
+
+/* fraction of the packets sent into layer 3 that were resends */
+double overhead(void)
+{
+  long sent = counters[A][C_TOLAYER3] + counters[B][C_TOLAYER3];
+
+  return sent > 0 ? (double)(counters[A][C_PACKETS_RESENT] + counters[B][C_PACKETS_RESENT]) / sent : 0.0;
+}
+
+void writejson(void)
+{
+  FILE *f;
+  int i;
+
+  if ((f = fopen(jsonfile, "w")) == NULL) {
+    printf("unable to write %s\n", jsonfile);
+    return;
+  }
+  fprintf(f, "{\"time\": %f, \"messages\": %d, \"flows\": %d, \"traffic\": \"%s\",\n ",
+          simtime, nsim, nflows, traffic->name);
+  fprintf(f, "\"goodput\": %f, \"retransmission_overhead\": %f,\n ", goodput(), overhead());
+  if (source != NULL)
+    fprintf(f, "\"stream\": {\"bytes\": %ld, \"intact\": %s},\n ", streambytes, streamok ? "true" : "false");
+  if (batching) {
+    fprintf(f, "\"confidence\": {\"level\": 0.95, \"stopped\": ");
+    if (stopreason != NULL)
+      fprintf(f, "\"%s\"", stopreason);
+    else
+      fprintf(f, "null");
+    fprintf(f, ", \"batch_length\": %f,\n  \"goodput\": ", goodputbatches.length);
+    printinterval_json(f, &goodputbatches);
+    fprintf(f, ",\n  \"delay\": ");
+    printinterval_json(f, &delaybatches);
+    fprintf(f, "},\n ");
+  }
+  stats_print_json(f);
+  fprintf(f, ",\n \"latency\": {\"A_to_B\": ");
+  hist_print_json(f, &latency[A]);
+  fprintf(f, ", \"B_to_A\": ");
+  hist_print_json(f, &latency[B]);
+  fprintf(f, "},\n \"queueing\": ");
+  hist_print_json(f, &queueing);
+  if (nstreams > 1) {
+    fprintf(f, ",\n \"stream_latency\": [");
+    for (i=0; i<nstreams; i++) {
+      fprintf(f, "%s\n  ", i ? "," : "");
+      hist_print_json(f, &streamlatency[i]);
+    }
+    fprintf(f, "]");
+  }
+  fprintf(f, ",\n \"sample_interval\": %f,\n \"samples\": [", sampleinterval);
+  for (i=0; i<nsamples; i++)
+    fprintf(f, "%s\n  {\"time\": %f, \"goodput\": %f, \"outstanding\": %ld, \"inmedium\": %ld}",
+            i ? "," : "", samples[i].time, samples[i].delivered / sampleinterval,
+            samples[i].outstanding, samples[i].inmedium);
+  fprintf(f, "]}\n");
+  fclose(f);
+}
+
+/* deliver one message to layer 5, counted by the caller */
+static void deliver(int AorB, struct msg *message)
+{
+  char *datasent = message->data;
+  int entity = ENTITY(current_flow, AorB);
+  int i;
+
+  if (TRACE>2) {
+    printf("          TOLAYER5: data received by application at ");
+    if (AorB == A) 
+      printf("A: ");
+    else
+      printf("B: ");
+    for (i=0; i<20; i++)  
+      printf("%c",datasent[i]);
+    printf("\n");
+  }
+  if (batching)
+    batch_record(&goodputbatches, 1.0);
+  if (readservice > 0.0)
+    readfree[entity] = (readfree[entity] > simtime ? readfree[entity] : simtime) + readservice;
+  recorddelivery(ENTITY(current_flow, (AorB+1) % 2), message->stream);
+  if (source != NULL)
+    streamdelivered(entity, datasent);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  struct msg message;
+
+  memcpy(message.data, datasent, 20);
+  message.stream = 0;
+  tolayer5_batch(AorB, &message, 1);
+}
+
+/* deliver n messages to A or B, in order, counting them all at once */
+void tolayer5_batch(int AorB, struct msg *messages, int n)
+{
+  int i;
+
+  counters[AorB][C_MESSAGES_DELIVERED] += n;
+  delivered[ENTITY(current_flow, AorB)] += n;
+  for (i=0; i<n; i++)
+    deliver(AorB, &messages[i]);
+}
+
+/* the message is not coming, so its send time goes without a delay */
+void tolayer5_lost(int AorB, int stream)
+{
+  double sent;
+
+  takesendtime(ENTITY(current_flow, (AorB+1) % 2), stream, &sent);
+}
+
+double currenttime(void)
+{
+  return simtime;
+}
+
+/* with -q the application reads one message each readservice, and a
+   protocol that finds it has no room is called back when it has */
+int tolayer5_room(int AorB)
+{
+  int entity = ENTITY(current_flow, AorB);
+  struct event *evptr;
+
+  if (readservice == 0.0)
+    return INT_MAX;
+  if (readfree[entity] <= simtime)
+    return 1;
+  if (!readwait[entity]) {
+    evptr = newevent();
+    evptr->evtime = readfree[entity];
+    evptr->evtype = LAYER5_READY;
+    evptr->eventity = entity;
+    insertevent(evptr);
+    readwait[entity] = 1;
+  }
+  return 0;
+}
+
+/* print the statistics for data sent by entity "from" to entity "to" */
+void printstats(int from, int to)
+{
+  printf("number of messages dropped due to full window:  %ld \n", counters[from][C_WINDOW_FULL]);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at %c:  %ld \n", 'A' + from, counters[from][C_NEW_ACKS]);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by %c:  %ld \n", 'A' + from, counters[from][C_PACKETS_RESENT]);
+  printf("number of correct packets received at %c:  %ld \n", 'A' + to, counters[to][C_PACKETS_RECEIVED]);
+  if (counters[from][C_FEC_PARITY] > 0) {
+    printf("number of parity packets sent by %c:  %ld (%f of the packets it sent) \n", 'A' + from,
+           counters[from][C_FEC_PARITY], (double)counters[from][C_FEC_PARITY] / counters[from][C_TOLAYER3]);
+    printf("number of packets rebuilt from parity at %c:  %ld (against %ld resends) \n", 'A' + to,
+           counters[to][C_FEC_RECOVERED], counters[from][C_PACKETS_RESENT]);
+  }
+  /* printed without pacing as well, as the baseline to compare it with */
+  printf("number of packets held back by the pacer at %c:  %ld, received again needlessly at %c:  %ld \n",
+         'A' + from, counters[from][C_PACED], 'A' + to, counters[to][C_SPURIOUS]);
+  if (counters[from][C_EXPIRED] > 0 || counters[to][C_LATE] > 0)
+    printf("number of messages given up on past their deadline by %c:  %ld, passed over at %c:  %ld, "
+           "too late at %c:  %ld \n", 'A' + from, counters[from][C_EXPIRED], 'A' + to,
+           counters[to][C_SKIPPED], 'A' + to, counters[to][C_LATE]);
+  if (counters[to][C_NAKS_SENT] > 0)
+    printf("number of NAKs sent by %c:  %ld, packets resent on a NAK by %c:  %ld \n", 'A' + to,
+           counters[to][C_NAKS_SENT], 'A' + from, counters[from][C_NAK_RESENDS]);
+  printf("number of messages delivered to application:  %ld \n", counters[to][C_MESSAGES_DELIVERED]);
+  if (latency[from].total > 0)
+    printf("message delay from %c to %c:  mean %f  p50 %f  p99 %f  p999 %f  max %f \n",
+           'A' + from, 'A' + to, hist_mean(&latency[from]), hist_percentile(&latency[from], 0.5),
+           hist_percentile(&latency[from], 0.99), hist_percentile(&latency[from], 0.999),
+           latency[from].max);
+}
+
+/* print the aggregate throughput and how fairly the flows shared the medium */
+#define FLOWDELIVERED(flow)  (delivered[ENTITY(flow, A)] + delivered[ENTITY(flow, B)])
+void printflowstats(void)
+{
+  double sum = 0.0, sumsq = 0.0;
+  int i, n, least = 0, most = 0;
+
+  for (i=0; i<nflows; i++) {
+    n = FLOWDELIVERED(i);
+    sum += n;
+    sumsq += (double)n * n;
+    if (n < FLOWDELIVERED(least))
+      least = i;
+    if (n > FLOWDELIVERED(most))
+      most = i;
+    if (TRACE>1)
+      printf("flow %d: messages delivered to application:  %d \n", i, n);
+  }
+  printf("\n---- %d flows ----\n", nflows);
+  printf("aggregate throughput (messages delivered per time unit):  %f \n", simtime > 0.0 ? sum/simtime : 0.0);
+  printf("fewest messages delivered on a flow:  %d (flow %d) \n", FLOWDELIVERED(least), least);
+  printf("most messages delivered on a flow:  %d (flow %d) \n", FLOWDELIVERED(most), most);
+  /* Jain's index: 1 when all flows get the same, 1/nflows when one gets all */
+  printf("fairness index:  %f \n", sumsq > 0.0 ? sum*sum/(nflows*sumsq) : 1.0);
+}
+
+#ifdef TIMING
+/* print the time spent in each event handler */
+void printtimings(void)
+{
+  int i;
+
+  printf("\n---- time spent in handlers ----\n");
+  printf("%ld events in %.3f s, %.0f events per second, %ld allocations, peak RSS %ld kB \n",
+         run.events, run.wallseconds, run.wallseconds > 0.0 ? run.events / run.wallseconds : 0.0,
+         run.allocations, run.maxrss);
+  for (i=0; i<NTIMINGS; i++)
+    if (timings[i].calls > 0)
+      printf("%-20s calls %10ld  ticks per call %12.1f  ns per call %10.1f \n",
+             timing_names[i], timings[i].calls, (double)timings[i].ticks / timings[i].calls,
+             timings[i].ticks * run.ns_per_tick / timings[i].calls);
+}
+#endif
+
+/* give message n from layer 5 to entity; whether it was accepted */
+int offer(int entity, int n)
+{
+  struct msg  msg2give;
+  long dropped;
+  int i;
+
+  fillmessage(entity, n, &msg2give);
+  if (TRACE>2) {
+    printf("          MAINLOOP: data given to student: ");
+    for (i=0; i<20; i++)
+      printf("%c", msg2give.data[i]);
+    printf("\n");
+  }
+  COUNT(SIDE(entity), C_MESSAGES_SENT);
+  dropped = counters[SIDE(entity)][C_WINDOW_FULL];
+  if (SIDE(entity) == A) {
+    TIME_START(T_A_OUTPUT);
+    protocol->A_output(msg2give);
+    TIME_STOP(T_A_OUTPUT);
+  }
+  else {
+    TIME_START(T_B_OUTPUT);
+    protocol->B_output(msg2give);
+    TIME_STOP(T_B_OUTPUT);
+  }
+  if (counters[SIDE(entity)][C_WINDOW_FULL] != dropped)
+    return 0;
+  recordsend(entity, msg2give.stream);
+  streamaccepted(entity);
+  return 1;
+}
+
+/* take the first event off the event list and handle it */
+void handleevent(void)
+{
+  struct event *eventptr;
+  struct pkt  pkt2give;
+  int i,n,accepted;
+
+  eventptr = evlist;            /* get next event to simulate */
+  evlist = evlist->next;        /* remove this event from event list */
+  if (evlist!=NULL)
+    evlist->prev=NULL;
+  GAUGE_ADD(G_EVENTS, -1);
+  run.events++;
+  if (eventptr->evtype == TIMER_INTERRUPT || eventptr->evtype == ACK_TIMER ||
+      eventptr->evtype == PACE_TIMER)
+    *timerslot(eventptr->evtype, eventptr->eventity) = NULL;
+  current_flow = FLOW(eventptr->eventity);
+  current_entity = eventptr->eventity;
+  if (TRACE>=2) {
+    printf("\nEVENT time: %f,",eventptr->evtime);
+    printf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      printf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      printf(", fromlayer5 ");
+    else if (eventptr->evtype==2)
+      printf(", fromlayer3 ");
+    else if (eventptr->evtype==3)
+      printf(", acktimerinterrupt ");
+    else if (eventptr->evtype==4)
+      printf(", pacetimerinterrupt ");
+    else
+      printf(", layer5ready ");
+    printf(" entity: %d\n",eventptr->eventity);
+  }
+  /* a checkpoint keeps the samples, for the runs that go on from it */
+  if ((jsonfile != NULL || csvfile != NULL || checkpointfile != NULL) && npartitions == 0)
+    takesamples(eventptr->evtime);
+  simtime = eventptr->evtime;        /* update time to next event time */
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if ((n = nextmessage(eventptr->eventity)) >= 0) {
+      generate_next_arrival(eventptr->eventity);   /* set up future arrival */
+      /* a saturating source goes on until a message is refused, and
+         keeps that one for later */
+      while ((accepted = offer(eventptr->eventity, n)) && traffic->saturate &&
+             (n = nextmessage(eventptr->eventity)) >= 0)
+        ;
+      if (traffic->saturate && !accepted)
+        nsim--;
+    }
+    else if (TRACE > 2)
+        printf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    pkt2give.connid = eventptr->pktptr->connid;
+    pkt2give.seqnum = eventptr->pktptr->seqnum;
+    pkt2give.acknum = eventptr->pktptr->acknum;
+    pkt2give.seqepoch = eventptr->pktptr->seqepoch;
+    pkt2give.ackepoch = eventptr->pktptr->ackepoch;
+    pkt2give.window = eventptr->pktptr->window;
+    pkt2give.inorder = eventptr->pktptr->inorder;
+    pkt2give.stream = eventptr->pktptr->stream;
+    pkt2give.streamseq = eventptr->pktptr->streamseq;
+    pkt2give.deadline = eventptr->pktptr->deadline;
+    pkt2give.checksum = eventptr->pktptr->checksum;
+    for (i=0; i<20; i++)
+      pkt2give.payload[i] = eventptr->pktptr->payload[i];
+	    if (SIDE(eventptr->eventity) ==A) {     /* deliver packet by calling */
+      TIME_START(T_A_INPUT);
+      protocol->A_input(pkt2give);            /* appropriate entity */
+      TIME_STOP(T_A_INPUT);
+    }
+    else {
+      TIME_START(T_B_INPUT);
+      protocol->B_input(pkt2give);
+      TIME_STOP(T_B_INPUT);
+    }
+	    efree(eventptr->pktptr);         /* free the memory for packet */
+    GAUGE_ADD(G_INMEDIUM, -1);
+  }
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    COUNT(SIDE(eventptr->eventity), C_TIMEOUTS);
+    if (SIDE(eventptr->eventity) == A) {
+      TIME_START(T_A_TIMERINTERRUPT);
+      protocol->A_timerinterrupt();
+      TIME_STOP(T_A_TIMERINTERRUPT);
+    }
+    else {
+      TIME_START(T_B_TIMERINTERRUPT);
+      protocol->B_timerinterrupt();
+      TIME_STOP(T_B_TIMERINTERRUPT);
+    }
+  }
+  else if (eventptr->evtype ==  ACK_TIMER) {
+    TIME_START(T_ACKTIMERINTERRUPT);
+    if (SIDE(eventptr->eventity) == A)
+      protocol->A_acktimerinterrupt();
+    else
+      protocol->B_acktimerinterrupt();
+    TIME_STOP(T_ACKTIMERINTERRUPT);
+  }
+  else if (eventptr->evtype ==  PACE_TIMER) {
+    TIME_START(T_PACETIMERINTERRUPT);
+    if (SIDE(eventptr->eventity) == A)
+      protocol->A_pacetimerinterrupt();
+    else
+      protocol->B_pacetimerinterrupt();
+    TIME_STOP(T_PACETIMERINTERRUPT);
+  }
+  else if (eventptr->evtype ==  LAYER5_READY) {
+    readwait[eventptr->eventity] = 0;
+    if (SIDE(eventptr->eventity) == A)
+      protocol->A_layer5ready();
+    else
+      protocol->B_layer5ready();
+  }
+  else  {
+    printf("INTERNAL PANIC: unknown event type \n");
+  }
+  efree(eventptr);
+}
+
+/* run one partition of the parallel engine, a window of LOOKAHEAD at a time */
+void *runpartition(void *arg)
+{
+  struct partition *me = arg;
+  struct event *p, *next;
+  double horizon;
+  int i;
+
+  mypartition = me - partitions;
+  while (1) {
+    /* the events other partitions sent here in the last window */
+    p = atomic_exchange_explicit(&me->mailbox, NULL, memory_order_acquire);
+    for (; p != NULL; p = next) {
+      next = p->next;
+      insertevent(p);
+    }
+    me->next = evlist != NULL ? evlist->evtime : HUGE_VAL;
+    pthread_barrier_wait(&barrier);
+    horizon = HUGE_VAL;
+    for (i=0; i<npartitions; i++)
+      if (partitions[i].next < horizon)
+        horizon = partitions[i].next;
+    if (horizon == HUGE_VAL)
+      break;
+    horizon += LOOKAHEAD;
+    while (evlist != NULL && evlist->evtime < horizon)
+      handleevent();
+    pthread_barrier_wait(&barrier);
+  }
+  me->time = simtime;
+  stats_save(&me->stats);
+  me->latency[A] = latency[A];
+  me->latency[B] = latency[B];
+  me->queueing = queueing;
+  return NULL;
+}
+
+/* run the parallel engine, this thread running the first partition, and
+   gather up what the others counted */
+void runpartitions(void)
+{
+  int i;
+
+  pthread_barrier_init(&barrier, NULL, npartitions);
+  for (i=1; i<npartitions; i++)
+    if (pthread_create(&partitions[i].thread, NULL, runpartition, &partitions[i]) != 0) {
+      printf("unable to start a thread for partition %d\n", i);
+      exit(EXIT_FAILURE);
+    }
+  runpartition(&partitions[0]);
+  for (i=1; i<npartitions; i++) {
+    pthread_join(partitions[i].thread, NULL);
+    stats_add(&partitions[i].stats);
+    hist_merge(&latency[A], &partitions[i].latency[A]);
+    hist_merge(&latency[B], &partitions[i].latency[B]);
+    hist_merge(&queueing, &partitions[i].queueing);
+    if (partitions[i].time > simtime)
+      simtime = partitions[i].time;
+  }
+  pthread_barrier_destroy(&barrier);
+  for (i=0; i<2*nflows; i++)
+    nsim += msgcount[i];
+}
+
+/* run protocol from where init() left the emulator, and report */
+int simulate(void)
+{
+  int i, status = EXIT_SUCCESS;
+
+  run_start();
+  if (resumefile != NULL)
+    restorecheckpoint();
+  else
+    for (current_flow=0; current_flow<nflows; current_flow++) {
+      current_entity = ENTITY(current_flow, A);
+      protocol->A_init();
+      current_entity = ENTITY(current_flow, B);
+      protocol->B_init();
+    }
+  if (batching)
+    startbatches();
+
+  if (npartitions == 0)
+    while (evlist != NULL) {
+      if (checkpointfile != NULL && evlist->evtime > checkpointtime) {
+        savecheckpoint();
+        break;
+      }
+      if (batching && stopearly(evlist->evtime))
+        break;
+      handleevent();
+    }
+  else
+    runpartitions();
+  run_stop();
+  replay_close();
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",simtime,nsim);
+  if (!bidirectional)
+    printstats(A, B);
+  else {
+    printf("packets sent into layer 3 (data, ACKs and resends together):  %ld \n",
+           counters[A][C_TOLAYER3] + counters[B][C_TOLAYER3]);
+    printf("\n---- A->B: %ld msgs given to A ----\n", counters[A][C_MESSAGES_SENT]);
+    printstats(A, B);
+    printf("\n---- B->A: %ld msgs given to B ----\n", counters[B][C_MESSAGES_SENT]);
+    printstats(B, A);
+  }
+  if (traffic != &sources[0])
+    printf("traffic source:  %s \n", traffic->name);
+  printf("goodput (messages delivered per time unit):  %f \n", goodput());
+  printf("retransmission overhead (resends / packets sent into layer 3):  %f \n", overhead());
+  if (batching) {
+    if (stopreason != NULL)
+      printf("stopped early at time %f:  %s \n", simtime, stopreason);
+    printinterval("goodput", &goodputbatches);
+    printinterval("message delay", &delaybatches);
+  }
+  if (nflows > 1)
+    printflowstats();
+  if (reorder)
+    printf("number of packets held back (reordered) by the medium:  %ld \n",
+           counters[A][C_REORDERED] + counters[B][C_REORDERED]);
+  if (dupprob > 0.0)
+    printf("number of packets duplicated by the medium:  %ld \n",
+           counters[A][C_DUPLICATED] + counters[B][C_DUPLICATED]);
+  if (nstreams > 1)
+    for (i=0; i<nstreams; i++)
+      printf("message delay on stream %d:  mean %f  p50 %f  p99 %f  max %f \n", i,
+             hist_mean(&streamlatency[i]), hist_percentile(&streamlatency[i], 0.5),
+             hist_percentile(&streamlatency[i], 0.99), streamlatency[i].max);
+  if (readservice > 0.0)
+    printf("most packets held in receive buffers at once:  %ld \n", gauges[G_RCVBUFFERED].max);
+  printf("time packets waited to go into the medium:  mean %f  p99 %f  max %f \n",
+         hist_mean(&queueing), hist_percentile(&queueing, 0.99), queueing.max);
+  if (fresharrivals > 0 || freshfates > 0)
+    printf("decisions drawn afresh after %s ran out:  %ld messages from layer 5, %ld packets \n",
+           replayfile, fresharrivals, freshfates);
+#ifdef TIMING
+  printtimings();
+#endif
+  if (source != NULL && !checkstreams())
+    status = EXIT_FAILURE;
+  if (jsonfile != NULL)
+    writejson();
+  if (csvfile != NULL)
+    writecsv();
+  return status;
+}
+
+int main(int argc, char **argv)
+{
+  pid_t pid;
+  int i, status, failed = 0;
+
+  parseargs(argc, argv);
+  init();
+  if (nruns == 1) {
+    protocol = runs[0];
+    return simulate();
+  }
+
+  /* each protocol runs in a process of its own, forked from the same
+     start, so that none inherits what another left behind.  The channel
+     they meet is the same through drawstreams */
+  for (i=0; i<nruns; i++) {
+    printf("\n==== %s ====\n", runs[i]->name);
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+      protocol = runs[i];
+      rewindtraffic();
+      exit(simulate());
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+      failed = 1;
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
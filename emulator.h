@@ -1,40 +1,78 @@
-extern int TRACE;
-
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
-
-#define   A    0
-#define   B    1
-
-/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
-/* 4 (students' code).  It contains the data (characters) to be delivered */
-/* to layer 5 via the students transport level protocol entities.         */
-struct msg {
-  char data[20];
-};
-
-/* a packet is the data unit passed from layer 4 (students code) to layer */
-/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
-struct pkt {
-  int seqnum;
-  int acknum;
-  int checksum;
-  char payload[20];
-};
-
-/* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
-
-/* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
-
-/* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
-
-/* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern int TRACE;
+extern int bidirectional;   /* 0 = A->B  1 =  A<->B */
+extern int nflows;          /* number of A and B pairs sharing the medium */
+extern _Thread_local int current_flow;  /* flow whose A or B this thread is calling, 0 to nflows-1 */
+
+/* statistics are counted with COUNT() from stats.h */
+
+#define   A    0
+#define   B    1
+
+/* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
+/* 4 (students' code).  It contains the data (characters) to be delivered */
+/* to layer 5 via the students transport level protocol entities.         */
+struct msg {
+  char data[20];
+  int stream;       /* the stream layer 5 sent it on, 0 unless it uses more */
+  double deadline;  /* time past which it is not worth delivering, 0 for none */
+};
+
+/* a packet is the data unit passed from layer 4 (students code) to layer */
+/* 3 (teachers code).  Note the pre-defined packet structure, which all   */
+/* students must follow. */
+struct pkt {
+  int connid;       /* the flow the packet belongs to, set to current_flow */
+  int seqnum;
+  int acknum;
+  int seqepoch;     /* times its sender's sequence numbers had gone round */
+  int ackepoch;     /*   at seqnum, and those it ACKs at acknum, if used */
+  int window;       /* room in the receive buffer of the packet's sender, if used, */
+  int inorder;      /*   beyond the packets it had had in order, this many so far */
+  int stream;       /* the stream of the message it carries, and its place */
+  int streamseq;    /*   in that stream, if used */
+  double deadline;  /* of the message it carries, if used */
+  int checksum;
+  char payload[20];
+};
+
+/* send to A or B (int) of the flow named by packet.connid, packet to send */
+extern void tolayer3(int, struct pkt);  
+
+/* deliver to A or B (int), data to deliver, as a message of stream 0 */
+extern void tolayer5(int, char[20]); 
+
+/* send to A or B (int) each of the packets, how many; the same as
+   tolayer3 on each in turn, for a protocol sending a run of its window */
+extern void tolayer3_batch(int, struct pkt *, int);
+
+/* deliver to A or B (int) each of the messages, how many, in order */
+extern void tolayer5_batch(int, struct msg *, int);
+
+/* tell A or B (int) that the next message of the stream (int) will never
+   come, as its sender gave up on it */
+extern void tolayer5_lost(int, int);
+
+/* how many messages the application at A or B (int) will take now.  When
+   it is 0, layer 5 calls A_layer5ready or B_layer5ready once there is room */
+extern int tolayer5_room(int);
+
+/* start timer at A or B (int), increment */
+extern void starttimer(int, double);       
+
+/* stop timer at A or B (int) */
+extern void stoptimer(int);
+
+/* start delayed ACK timer at A or B (int), increment */
+extern void startacktimer(int, double);
+
+/* stop delayed ACK timer at A or B (int) */
+extern void stopacktimer(int);               
+
+/* the current time, in the units of the timers */
+extern double currenttime(void);
+
+/* start pacing timer at A or B (int), increment */
+extern void startpacetimer(int, double);
+
+/* stop pacing timer at A or B (int) */
+extern void stoppacetimer(int);
@@ -1,275 +1,519 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include "emulator.h"
-#include "gbn.h"
-
-/* ******************************************************************
-   Go Back N protocol.  Adapted from J.F.Kurose
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications: 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - fixed C style to adhere to current programming style
-   - added GBN implementation
-**********************************************************************/
-
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
-#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
-
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-int ComputeChecksum(struct pkt packet)
-{
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
-}
-
-bool IsCorrupted(struct pkt packet)
-{
-  if (packet.checksum == ComputeChecksum(packet))
-    return (false);
-  else
-    return (true);
-}
-
-
-/********* Sender (A) variables and functions ************/
-
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{
-  struct pkt sendpkt;
-  int i;
-
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
-
-    /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
-  }
-  /* if blocked,  window is full */
-  else {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
-  }
-}
-
-
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
-{
-  int ackcount = 0;
-  int i;
-
-  /* if received ACK is not corrupted */ 
-  if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
-
-    /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
-          /* check case when seqnum has and hasn't wrapped */
-          if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-              ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
-
-            /* packet is a new ACK */
-            if (TRACE > 0)
-              printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
-
-            /* cumulative acknowledgement - determine how many packets are ACKed */
-            if (packet.acknum >= seqfirst)
-              ackcount = packet.acknum + 1 - seqfirst;
-            else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
-
-	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
-
-            /* delete the acked packets from window buffer */
-            for (i=0; i<ackcount; i++)
-              windowcount--;
-
-	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
-
-          }
-        }
-        else
-          if (TRACE > 0)
-        printf ("----A: duplicate ACK received, do nothing!\n");
-  }
-  else 
-    if (TRACE > 0)
-      printf ("----A: corrupted ACK is received, do nothing!\n");
-}
-
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
-{
-  int i;
-
-  if (TRACE > 0)
-    printf("----A: time out,resend packets!\n");
-
-  for(i=0; i<windowcount; i++) {
-
-    if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
-
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
-  }
-}       
-
-
-
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-}
-
-
-
-/********* Receiver (B)  variables and procedures ************/
-
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-
-
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
-{
-  struct pkt sendpkt;
-  int i;
-
-  /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
-
-    /* deliver to receiving application */
-    tolayer5(B, packet.payload);
-
-    /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
-
-    /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
-  }
-  else {
-    /* packet is corrupted or out of order resend last ACK */
-    if (TRACE > 0) 
-      printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
-    else
-      sendpkt.acknum = expectedseqnum - 1;
-  }
-
-  /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
-    
-  /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ ) 
-    sendpkt.payload[i] = '0';  
-
-  /* computer checksum */
-  sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-  /* send out packet */
-  tolayer3 (B, sendpkt);
-}
-
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
-{
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
-}
-
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
-
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
-{
-}
-
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
-{
-}
-
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "stats.h"
+#include "protocol.h"
+#include "gbn.h"
+
+/* ******************************************************************
+   Go Back N protocol.  Adapted from J.F.Kurose
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+
+   Modifications: 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - fixed C style to adhere to current programming style
+   - added GBN implementation
+   - Go-Back-N for both A and B, so data can flow in both directions,
+   with cumulative ACKs piggybacked on data packets
+**********************************************************************/
+
+#ifndef RTT
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
+#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
+#endif
+#define SEQSPACE (WINDOWSIZE + 1)  /* the min sequence space for GBN must be at least windowsize + 1 */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define ACKDELAY 2.0    /* the longest an ACK waits for a data packet to ride on */
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+static int ComputeChecksum(struct pkt packet)
+{
+  int checksum = 0;
+  int i;
+
+  checksum = packet.connid;
+  checksum += packet.seqnum;
+  checksum += packet.acknum;
+  checksum += packet.seqepoch;
+  checksum += packet.ackepoch;
+  for ( i=0; i<20; i++ ) 
+    checksum += (int)(packet.payload[i]);
+
+  return checksum;
+}
+
+static bool IsCorrupted(struct pkt packet)
+{
+  if (packet.checksum == ComputeChecksum(packet))
+    return (false);
+  else
+    return (true);
+}
+
+
+
+/********* Sender variables and functions ************/
+/* Both A and B of every flow have a sender and a receiver, found with
+   STATE(AorB).  With simplex transfer only A's sender and B's receiver
+   are used.
+
+   Packets carry the epoch of their seqnum and acknum, the times the
+   sequence numbers had gone round, so that a copy the medium held back
+   from an earlier time round is not taken for the packet now using its
+   number. */
+
+#define STATE(AorB) (2*current_flow + (AorB))
+
+struct sender {
+  struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  int nextepoch;                  /*   and its epoch */
+};
+
+static struct sender *snd;  /* indexed by STATE(A or B) */
+
+static int TakePendingAck(int AorB, int *epoch);
+
+/* make a data packet ready to send, carrying any ACK waiting to go the
+   other way */
+static void PrepareData(int AorB, struct pkt *packet)
+{
+  packet->connid = current_flow;
+  packet->acknum = TakePendingAck(AorB, &packet->ackepoch);
+  packet->checksum = ComputeChecksum(*packet);
+}
+
+/* send a data packet */
+static void SendData(int AorB, struct pkt *packet)
+{
+  PrepareData(AorB, packet);
+  tolayer3(AorB, *packet);
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void Output(int AorB, struct msg message)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  struct pkt sendpkt;
+  int i;
+
+  /* if not blocked waiting on ACK */
+  if ( s->windowcount < WINDOWSIZE) {
+    if (TRACE > 1)
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", 'A' + AorB);
+
+    /* create packet */
+    sendpkt.seqnum = s->nextseqnum;
+    sendpkt.seqepoch = s->nextepoch;
+    for ( i=0; i<20 ; i++ ) 
+      sendpkt.payload[i] = message.data[i];
+
+    /* put packet in window buffer */
+    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
+    s->windowlast = (s->windowlast + 1) % WINDOWSIZE; 
+    s->windowcount++;
+
+    /* send out packet */
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
+    SendData(AorB, &sendpkt);
+    s->buffer[s->windowlast] = sendpkt;
+
+    /* start timer if first packet in window */
+    if (s->windowcount == 1)
+      starttimer(AorB,RTT);
+
+    /* get next sequence number, wrap back to 0 */
+    s->nextseqnum = (s->nextseqnum + 1) % SEQSPACE;  
+    if (s->nextseqnum == 0)
+      s->nextepoch++;
+  }
+  /* if blocked,  window is full */
+  else {
+    if (TRACE > 0)
+      printf("----%c: New message arrives, send window is full\n", 'A' + AorB);
+    COUNT(AorB, C_WINDOW_FULL);
+  }
+}
+
+
+/* an uncorrupted ACK (pure or piggybacked) has arrived at AorB */
+static void AckInput(int AorB, int acknum, int epoch)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  int ackcount = 0;
+  int i;
+
+  if (TRACE > 0)
+    printf("----%c: uncorrupted ACK %d is received\n", 'A' + AorB, acknum);
+  COUNT(AorB, C_ACKS_RECEIVED);
+
+  /* check if new ACK or duplicate */
+  if (s->windowcount != 0) {
+    int seqfirst = s->buffer[s->windowfirst].seqnum;
+    int seqlast = s->buffer[s->windowlast].seqnum;
+    /* check case when seqnum has and hasn't wrapped */
+    if (((seqfirst <= seqlast) && (acknum >= seqfirst && acknum <= seqlast)) ||
+        ((seqfirst > seqlast) && (acknum >= seqfirst || acknum <= seqlast))) {
+
+      /* cumulative acknowledgement - determine how many packets are ACKed */
+      if (acknum >= seqfirst)
+        ackcount = acknum + 1 - seqfirst;
+      else
+        ackcount = SEQSPACE - seqfirst + acknum + 1;
+
+      /* one of another epoch is left over from an earlier time round */
+      if (s->buffer[(s->windowfirst + ackcount - 1) % WINDOWSIZE].seqepoch != epoch) {
+        if (TRACE > 0)
+          printf("----%c: ACK %d is from an earlier epoch, do nothing!\n", 'A' + AorB, acknum);
+        return;
+      }
+
+      /* packet is a new ACK */
+      if (TRACE > 0)
+        printf("----%c: ACK %d is not a duplicate\n", 'A' + AorB, acknum);
+      COUNT(AorB, C_NEW_ACKS);
+
+      /* slide window by the number of packets ACKed */
+      s->windowfirst = (s->windowfirst + ackcount) % WINDOWSIZE;
+
+      /* delete the acked packets from window buffer */
+      for (i=0; i<ackcount; i++)
+        s->windowcount--;
+
+      /* start timer again if there are still more unacked packets in window */
+      stoptimer(AorB);
+      if (s->windowcount > 0)
+        starttimer(AorB, RTT);
+    }
+  }
+  else
+    if (TRACE > 0)
+      printf ("----%c: duplicate ACK received, do nothing!\n", 'A' + AorB);
+}
+
+/* called when the retransmission timer of AorB goes off */
+static void TimerInterrupt(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  struct pkt resend[WINDOWSIZE];  /* the whole window, sent together */
+  int i;
+
+  if (TRACE > 0)
+    printf("----%c: time out,resend packets!\n", 'A' + AorB);
+
+  for(i=0; i<s->windowcount; i++) {
+
+    if (TRACE > 0)
+      printf ("---%c: resending packet %d\n", 'A' + AorB, (s->buffer[(s->windowfirst+i) % WINDOWSIZE]).seqnum);
+
+    PrepareData(AorB, &s->buffer[(s->windowfirst+i) % WINDOWSIZE]);
+    resend[i] = s->buffer[(s->windowfirst+i) % WINDOWSIZE];
+    COUNT(AorB, C_PACKETS_RESENT);
+  }
+  tolayer3_batch(AorB, resend, s->windowcount);
+  if (s->windowcount > 0)
+    starttimer(AorB,RTT);
+}       
+
+static void SenderInit(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+
+  /* initialise the window, buffer and sequence number */
+  s->nextseqnum = 0;  /* starts with seq num 0, do not change this */
+  s->nextepoch = 0;
+  s->windowfirst = 0;
+  s->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+		     new packets are placed in winlast + 1 
+		     so initially this is set to -1
+		   */
+  s->windowcount = 0;
+}
+
+
+
+/********* Receiver variables and procedures ************/
+
+struct receiver {
+  int expectedseqnum;  /* the sequence number expected next by the receiver */
+  int epoch;           /*   and its epoch */
+  int pendingack;      /* ACK waiting for a data packet to ride on */
+  int pendingepoch;    /*   and the epoch it ACKs */
+};
+
+static struct receiver *rcv;  /* indexed by STATE(A or B) */
+
+/* send an ACK now as a packet of its own, of a packet of the epoch */
+static void SendPureAck(int AorB, int acknum, int epoch)
+{
+  struct pkt sendpkt;
+  int i;
+
+  sendpkt.connid = current_flow;
+  sendpkt.seqnum = NOTINUSE;  /* no data in this packet */
+  sendpkt.acknum = acknum;
+  sendpkt.seqepoch = 0;
+  sendpkt.ackepoch = epoch;
+
+  /* we don't have any data to send.  fill payload with 0's */
+  for ( i=0; i<20 ; i++ ) 
+    sendpkt.payload[i] = '0';  
+
+  /* computer checksum */
+  sendpkt.checksum = ComputeChecksum(sendpkt); 
+
+  /* send out packet */
+  tolayer3 (AorB, sendpkt);
+}
+
+/* ACK a received packet of the epoch.  With bidirectional transfer the
+   ACK is held back for up to ACKDELAY in the hope that a data packet
+   leaves first.  ACKs are cumulative so a newer ACK simply replaces one
+   already waiting. */
+static void SendAck(int AorB, int acknum, int epoch)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  if (!bidirectional) {
+    SendPureAck(AorB, acknum, epoch);
+    return;
+  }
+  if (r->pendingack == NOTINUSE)
+    startacktimer(AorB, ACKDELAY);
+  r->pendingack = acknum;
+  r->pendingepoch = epoch;
+}
+
+/* remove and return the ACK waiting to be piggybacked, if any, and set
+   epoch to the epoch it ACKs */
+static int TakePendingAck(int AorB, int *epoch)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int acknum = r->pendingack;
+
+  *epoch = r->pendingepoch;
+  if (acknum != NOTINUSE) {
+    stopacktimer(AorB);
+    r->pendingack = NOTINUSE;
+  }
+  return acknum;
+}
+
+/* called when the delayed ACK timer of AorB goes off */
+static void AckTimerInterrupt(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  if (r->pendingack != NOTINUSE) {
+    SendPureAck(AorB, r->pendingack, r->pendingepoch);
+    r->pendingack = NOTINUSE;
+  }
+}
+
+/* a packet that may carry data has arrived at AorB */
+static void DataInput(int AorB, struct pkt packet, bool corrupted)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  if (!corrupted)
+    COUNT(AorB, C_PACKETS_RECEIVED);
+
+  /* if not corrupted and received packet is in order */
+  if  ( (!corrupted)  && (packet.seqnum == r->expectedseqnum) && (packet.seqepoch == r->epoch) ) {
+    if (TRACE > 0)
+      printf("----%c: packet %d is correctly received, send ACK!\n", 'A' + AorB, packet.seqnum);
+
+    /* deliver to receiving application */
+    tolayer5(AorB, packet.payload);
+
+    /* send an ACK for the received packet */
+    SendAck(AorB, r->expectedseqnum, r->epoch);
+
+    /* update state variables */
+    r->expectedseqnum = (r->expectedseqnum + 1) % SEQSPACE;        
+    if (r->expectedseqnum == 0)
+      r->epoch++;
+  }
+  else {
+    /* packet is corrupted or out of order resend last ACK */
+    if (TRACE > 0) 
+      printf("----%c: packet corrupted or not expected sequence number, resend ACK!\n", 'A' + AorB);
+    if (r->expectedseqnum == 0)
+      SendAck(AorB, SEQSPACE - 1, r->epoch - 1);
+    else
+      SendAck(AorB, r->expectedseqnum - 1, r->epoch);
+  }
+}
+
+static void ReceiverInit(int AorB)
+{
+  rcv[STATE(AorB)].expectedseqnum = 0;
+  rcv[STATE(AorB)].epoch = 0;
+  rcv[STATE(AorB)].pendingack = NOTINUSE;
+  rcv[STATE(AorB)].pendingepoch = 0;
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at AorB */
+static void Input(int AorB, struct pkt packet)
+{
+  if (IsCorrupted(packet)) {
+    COUNT(AorB, C_CORRUPT_RECEIVED);
+    if (TRACE > 0)
+      printf ("----%c: corrupted packet is received!\n", 'A' + AorB);
+    /* the receiver answers anything that might have been data, as before */
+    if (AorB == B || bidirectional)
+      DataInput(AorB, packet, true);
+    return;
+  }
+  if (packet.acknum != NOTINUSE)
+    AckInput(AorB, packet.acknum, packet.ackepoch);
+  if (packet.seqnum != NOTINUSE)
+    DataInput(AorB, packet, false);
+}
+
+
+/********* Entry points called by the emulator ************/
+
+/* the state of every flow is allocated when the first flow is initialised */
+static void AllocState(void)
+{
+  if (snd != NULL)
+    return;
+  snd = malloc(2*nflows * sizeof(struct sender));
+  rcv = malloc(2*nflows * sizeof(struct receiver));
+  if (snd == NULL || rcv == NULL) {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void A_output(struct msg message)
+{
+  Output(A, message);
+}
+
+static void A_input(struct pkt packet)
+{
+  Input(A, packet);
+}
+
+static void A_timerinterrupt(void)
+{
+  TimerInterrupt(A);
+}
+
+/* GBN sends as soon as its window has room, so the pacing timers are unused */
+static void A_pacetimerinterrupt(void)
+{
+}
+
+/* nor does it ask layer 5 for room before delivering */
+static void A_layer5ready(void)
+{
+}
+
+static void A_acktimerinterrupt(void)
+{
+  AckTimerInterrupt(A);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+static void A_init(void)
+{
+  AllocState();
+  SenderInit(A);
+  ReceiverInit(A);
+}
+
+static void B_output(struct msg message)  
+{
+  Output(B, message);
+}
+
+static void B_input(struct pkt packet)
+{
+  Input(B, packet);
+}
+
+static void B_timerinterrupt(void)
+{
+  TimerInterrupt(B);
+}
+
+static void B_pacetimerinterrupt(void)
+{
+}
+
+static void B_layer5ready(void)
+{
+}
+
+static void B_acktimerinterrupt(void)
+{
+  AckTimerInterrupt(B);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+static void B_init(void)
+{
+  AllocState();
+  SenderInit(B);
+  ReceiverInit(B);
+}
+
+/********* Checkpoints ************/
+
+/* the sizes of the state go first, so that a checkpoint of another
+   protocol, or of another window size, is refused */
+static void protocol_save(FILE *f)
+{
+  size_t sizes[2] = { sizeof(struct sender), sizeof(struct receiver) };
+
+  fwrite(sizes, sizeof(sizes), 1, f);
+  fwrite(snd, sizeof(struct sender), 2*nflows, f);
+  fwrite(rcv, sizeof(struct receiver), 2*nflows, f);
+}
+
+static int protocol_restore(FILE *f)
+{
+  size_t sizes[2];
+
+  AllocState();
+  return fread(sizes, sizeof(sizes), 1, f) == 1
+         && sizes[0] == sizeof(struct sender) && sizes[1] == sizeof(struct receiver)
+         && fread(snd, sizeof(struct sender), 2*nflows, f) == (size_t)(2*nflows)
+         && fread(rcv, sizeof(struct receiver), 2*nflows, f) == (size_t)(2*nflows);
+}
+
+const struct protocol gbn_protocol = {
+  "gbn", 0, 0, 0, 1,   /* delivers through tolayer5(), as stream 0, without
+                          asking layer 5 for room */
+  A_init, B_init,
+  A_input, B_input,
+  A_output, B_output,
+  A_timerinterrupt, B_timerinterrupt,
+  A_acktimerinterrupt, B_acktimerinterrupt,
+  A_pacetimerinterrupt, B_pacetimerinterrupt,
+  A_layer5ready, B_layer5ready,
+  protocol_save, protocol_restore
+};
@@ -0,0 +1,48 @@
+/* ******************************************************************
+   The entry points of a protocol, through which the emulator and the
+   UDP harness call it.
+
+   Each protocol source keeps its A_ and B_ routines to itself and hands
+   them over in a struct protocol named after the source, sr_protocol in
+   sr.c and so on.  protocols.c lists the ones a program is linked with,
+   each put in by -DWITH_SR, -DWITH_GBN or -DWITH_SR_VERSION4, so that
+   several can share one executable and be chosen by name when it
+   starts.  The emulator runs one of them at a time.
+   ******************************************************************/
+
+struct protocol {
+  char *name;
+  int maxflows;         /* most flows it keeps apart, 0 for any number */
+  int streams;          /* whether it delivers each message with its stream */
+  int flowcontrol;      /* whether it asks layer 5 for room before delivering */
+  int duplex;           /* whether B sends as well as A, for -b */
+  void (*A_init)(void);
+  void (*B_init)(void);
+  void (*A_input)(struct pkt);
+  void (*B_input)(struct pkt);
+  void (*A_output)(struct msg);
+  void (*B_output)(struct msg);
+  void (*A_timerinterrupt)(void);
+  void (*B_timerinterrupt)(void);
+  void (*A_acktimerinterrupt)(void);
+  void (*B_acktimerinterrupt)(void);
+  void (*A_pacetimerinterrupt)(void);
+  void (*B_pacetimerinterrupt)(void);
+  void (*A_layer5ready)(void);
+  void (*B_layer5ready)(void);
+
+  /* checkpoints: write the state of every A and B to a file, and read it
+     back; restore returns 0 if this protocol did not write it */
+  void (*save)(FILE *);
+  int (*restore)(FILE *);
+};
+
+extern const struct protocol sr_protocol;
+extern const struct protocol gbn_protocol;
+extern const struct protocol sr_version4_protocol;
+
+/* the protocols linked in, the default first, ending with NULL */
+extern const struct protocol *const protocols[];
+
+/* the protocol linked in with this name, or NULL */
+extern const struct protocol *findprotocol(char *name);
@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "protocol.h"
+
+const struct protocol *const protocols[] = {
+#ifdef WITH_SR
+  &sr_protocol,
+#endif
+#ifdef WITH_GBN
+  &gbn_protocol,
+#endif
+#ifdef WITH_SR_VERSION4
+  &sr_version4_protocol,
+#endif
+  NULL
+};
+
+const struct protocol *findprotocol(char *name)
+{
+  int i;
+
+  for (i=0; protocols[i] != NULL; i++)
+    if (strcmp(protocols[i]->name, name) == 0)
+      return protocols[i];
+  return NULL;
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "replay.h"
+
+#define MAGIC "SRLOG001"
+
+/* each chunk in the file follows one of these */
+struct chunkheader {
+  unsigned int stream;
+  unsigned int length;
+};
+
+/* a stream being recorded, or the position of one being replayed */
+struct stream {
+  unsigned char buf[REPLAY_CHUNK];  /* recording: bytes not yet written */
+  int count;
+  const unsigned char *p, *end;     /* replaying: what is left of the chunk */
+  size_t next;                      /*   and where to look for the next one */
+};
+
+static struct stream *streams;
+static int nstreams;
+static FILE *out;                   /* the log being recorded */
+static const unsigned char *in;     /* the log being replayed, mapped */
+static size_t insize;
+
+static void fail(char *what, char *file)
+{
+  printf("unable to %s the decision log %s\n", what, file);
+  exit(EXIT_FAILURE);
+}
+
+static void allocate(int n)
+{
+  int i;
+
+  if ((streams = malloc(n * sizeof(struct stream))) == NULL) {
+    printf("memory allocation for the decision log failed.");
+    exit(EXIT_FAILURE);
+  }
+  nstreams = n;
+  for (i=0; i<n; i++) {
+    streams[i].count = 0;
+    streams[i].p = streams[i].end = NULL;
+    streams[i].next = sizeof(MAGIC) - 1 + sizeof(unsigned int);
+  }
+}
+
+void replay_record(char *file, int n)
+{
+  unsigned int header = n;
+
+  if ((out = fopen(file, "wb")) == NULL
+      || fwrite(MAGIC, sizeof(MAGIC) - 1, 1, out) != 1
+      || fwrite(&header, sizeof(header), 1, out) != 1)
+    fail("write", file);
+  allocate(n);
+}
+
+void replay_open(char *file, int n)
+{
+  struct stat st;
+  unsigned int header;
+  int fd;
+
+  if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+    fail("read", file);
+  insize = st.st_size;
+  if (insize < sizeof(MAGIC) - 1 + sizeof(header)
+      || (in = mmap(NULL, insize, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED
+      || memcmp(in, MAGIC, sizeof(MAGIC) - 1) != 0)
+    fail("read", file);
+  close(fd);
+  memcpy(&header, in + sizeof(MAGIC) - 1, sizeof(header));
+  if (header != (unsigned int)n) {
+    printf("the decision log %s has %u streams, this run needs %d; were the flows the same?\n",
+           file, header, n);
+    exit(EXIT_FAILURE);
+  }
+  allocate(n);
+}
+
+static void writechunk(int stream)
+{
+  struct chunkheader h;
+
+  h.stream = stream;
+  h.length = streams[stream].count;
+  if (fwrite(&h, sizeof(h), 1, out) != 1
+      || fwrite(streams[stream].buf, 1, h.length, out) != h.length) {
+    printf("unable to write the decision log\n");
+    exit(EXIT_FAILURE);
+  }
+  streams[stream].count = 0;
+}
+
+void replay_putbyte(int stream, unsigned char b)
+{
+  struct stream *s = &streams[stream];
+
+  if (s->count == REPLAY_CHUNK)
+    writechunk(stream);
+  s->buf[s->count++] = b;
+}
+
+void replay_putword(int stream, unsigned int w)
+{
+  unsigned char b[sizeof(w)];
+  size_t i;
+
+  memcpy(b, &w, sizeof(w));
+  for (i=0; i<sizeof(w); i++)
+    replay_putbyte(stream, b[i]);
+}
+
+/* move a stream on to its next chunk; 0 if it has none */
+static int nextchunk(struct stream *s, int stream)
+{
+  struct chunkheader h;
+
+  while (s->next + sizeof(h) <= insize) {
+    memcpy(&h, in + s->next, sizeof(h));
+    s->next += sizeof(h) + h.length;
+    if (s->next > insize)
+      break;
+    if (h.stream == (unsigned int)stream && h.length > 0) {
+      s->p = in + s->next - h.length;
+      s->end = in + s->next;
+      return 1;
+    }
+  }
+  s->next = insize;
+  return 0;
+}
+
+int replay_getbyte(int stream, unsigned char *b)
+{
+  struct stream *s = &streams[stream];
+
+  if (s->p == s->end && !nextchunk(s, stream))
+    return 0;
+  *b = *s->p++;
+  return 1;
+}
+
+int replay_getword(int stream, unsigned int *w)
+{
+  unsigned char b[sizeof(*w)];
+  size_t i;
+
+  for (i=0; i<sizeof(*w); i++)
+    if (!replay_getbyte(stream, &b[i]))
+      return 0;
+  memcpy(w, b, sizeof(*w));
+  return 1;
+}
+
+void replay_close(void)
+{
+  int i;
+
+  if (out == NULL)
+    return;
+  for (i=0; i<nstreams; i++)
+    if (streams[i].count > 0)
+      writechunk(i);
+  fclose(out);
+  out = NULL;
+}
@@ -0,0 +1,35 @@
+/* ******************************************************************
+   A log of the random decisions of a run, for record and replay.
+
+   The log holds a number of streams, each a sequence of bytes and
+   words written and later read back in the same order.  The emulator
+   keeps one stream for the messages layer 5 gives each flow and one for
+   the packets each entity sends, so that a run replayed with a changed
+   protocol still sees the same channel: the nth packet an entity sends
+   meets the same fate, whatever the packets before it were.
+
+   While recording, each stream collects its bytes in a chunk of its own,
+   and a full chunk is appended to the file behind a header naming the
+   stream, so the file is written in one pass with bounded memory.  For
+   replay the file is mapped and each stream reads its chunks in turn.
+   Words are in the byte order of the machine that wrote them.
+   ******************************************************************/
+
+#define REPLAY_CHUNK 4096       /* bytes of a stream kept before writing */
+
+/* start recording to, or replaying from, a log of nstreams streams;
+   either gives up the run if the file cannot be used */
+extern void replay_record(char *file, int nstreams);
+extern void replay_open(char *file, int nstreams);
+
+/* append to a stream while recording */
+extern void replay_putbyte(int stream, unsigned char);
+extern void replay_putword(int stream, unsigned int);
+
+/* read the next byte or word of a stream while replaying; 0 once the
+   stream is exhausted, 1 otherwise */
+extern int replay_getbyte(int stream, unsigned char *);
+extern int replay_getword(int stream, unsigned int *);
+
+/* write out what is left of the streams being recorded */
+extern void replay_close(void);
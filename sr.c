@@ -1,356 +1,1358 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <stdbool.h>
-#include "emulator.h"
-#include "sr.h"
-
-
-
-
-/* ******************************************************************
-   Go Back N protocol.  Adapted from J.F.Kurose
-   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
-
-   Network properties:
-   - one way network delay averages five time units (longer if there
-   are other messages in the channel for GBN), but can be larger
-   - packets can be corrupted (either the header or the data portion)
-   or lost, according to user-defined probabilities
-   - packets will be delivered in the order in which they were sent
-   (although some can be lost).
-
-   Modifications: 
-   - removed bidirectional GBN code and other code not used by prac. 
-   - fixed C style to adhere to current programming style
-   - added GBN implementation
-**********************************************************************/
-
-#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 12     /* the min sequence space for GBN must be at least windowsize *2 */
-#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-
-
-int ComputeChecksum(struct pkt packet)
-{
-  int checksum = 0;
-  int i;
-
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
-
-  return checksum;
-}
-
-bool IsCorrupted(struct pkt packet)
-{
-  if (packet.checksum == ComputeChecksum(packet))
-    return (false);
-  else
-    return (true);
-}
-
-
-/********* Sender (A) variables and functions ************/
-
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static int timer_packet = -1;        /* The seqnum of the packet currently being timed */
-static bool acked[SEQSPACE];         /* Track which packets are ACKed */
-
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
-{
-  struct pkt sendpkt;
-  int i;
-  
-
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-    acked[sendpkt.seqnum] = false;
-
-    /* send out packet */
-    if (TRACE > 0){
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    }
-    tolayer3 (A, sendpkt);
-
-    windowcount++;
-
-    /* If this is the first unACKed packet, start the timer */
-    if (timer_packet == -1) {
-      starttimer(A, RTT);
-      timer_packet = sendpkt.seqnum;
-  }
-
-    /* start timer if first packet in window */
-    /* if (windowcount == 1)*/
-    /*   starttimer(A,RTT);*/
-    /* Using new timer 1logic*/
-    
-
-    
-
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
-  }
-  /* if blocked,  window is full */
-  else {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
-  }
-}
-
-
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-*/
-void A_input(struct pkt packet)
-{
-    int i;
-    if (!IsCorrupted(packet)) {
-        if (TRACE > 0) {
-            printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-        }
-
-        new_ACKs++;
-
-        if (acked[packet.acknum]) {
-            if (TRACE > 0) {
-                printf("----A: duplicate ACK received, do nothing!\n");
-            }
-        } else {
-            if (TRACE > 0) {
-                printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-            }
-
-            acked[packet.acknum] = true;
-
-            /* Slide window forward */
-            while (windowcount > 0 && acked[buffer[windowfirst].seqnum]) {
-                windowfirst = (windowfirst + 1) % WINDOWSIZE;
-                windowcount--;
-            }
-
-            /* Reassign timer if this was the packet being timed */
-            if (packet.acknum == timer_packet) {
-                stoptimer(A);
-                timer_packet = -1;
-
-                /* Find next unACKed packet in the window */
-                
-                for (i = 0; i < windowcount; i++) {
-                    int index = (windowfirst + i) % WINDOWSIZE;
-                    if (!acked[buffer[index].seqnum]) {
-                        timer_packet = buffer[index].seqnum;
-                        starttimer(A, RTT);
-                        if (TRACE == 1) {
-                            printf("----A: Timer now set for packet %d\n", timer_packet);
-                        }
-                        break;
-                    }
-                }
-            }
-        }
-    } else {
-        if (TRACE > 0) {
-            printf("----A: corrupted ACK is received, do nothing!\n");
-        }
-    }
-}
-
-
-
-
-
-/* called when A's timer goes off */
-void A_timerinterrupt(void)
-{
-    
-
-    if (TRACE > 0){
-        printf("----A: time out,resend packets!\n");
-    
-        if (timer_packet != -1) {
-          if (TRACE > 0){
-              printf("---A: resending packet %d\n", timer_packet);
-          }
-          tolayer3(A, buffer[timer_packet]);
-          packets_resent++;
-  
-          starttimer(A, RTT);  
-        }
-      }
-
-}
-       
-
-
-
-/* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
-{
-  int i;
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
-		     new packets are placed in winlast + 1 
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-  timer_packet = -1;
-  for (i = 0; i < SEQSPACE; i++){
-    acked[i] = false;
-  }
-
-}
-
-
-
-/********* Receiver (B)  variables and procedures ************/
-
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-static bool received[SEQSPACE];    /* Marks which packets have been received */
-/*static struct pkt recv_buffer[SEQSPACE]; Stores received packets */
-
-
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-#define MAX_PAYLOAD_SIZE 20
-
-static struct pkt recv_buffer[SEQSPACE];  /* To store out-of-order packets */
-static bool received[SEQSPACE];           /* To track which packets are received */
-static int expectedseqnum;                /* Base of receiver window */
-static int B_nextseqnum;                  /* For generating ACK packet seqnum */
-
-bool InWindow(int seq, int base, int window_size) {
-  if (base + window_size < SEQSPACE) {
-      return seq >= base && seq < base + window_size;
-  } else {
-      return seq >= base || seq < (base + window_size) % SEQSPACE;
-  }
-}
-
-
-void B_input(struct pkt packet)
-{
-    struct pkt ackpkt;
-    int seq = packet.seqnum;
-    int i;
-    
-    bool in_window;
-
-    if (IsCorrupted(packet)) {
-        if (TRACE == 1) {
-            printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-        }
-        return;
-    }
-
-    packets_received++;
-    
-    in_window = InWindow(seq, expectedseqnum, WINDOWSIZE);
-
-
-    if (in_window) {
-        
-
-        if (!received[seq]) {
-            if (TRACE > 0) {
-                printf("----B: packet %d is correctly received, send ACK!\n", seq);
-            }
-
-            recv_buffer[seq] = packet;
-            received[seq] = true;
-        }
-
-        while (received[expectedseqnum]) {
-            tolayer5(B, recv_buffer[expectedseqnum].payload);
-            received[expectedseqnum] = false;
-            expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
-        }
-    } else {
-        if (TRACE > 0) {
-            printf("----B: packet %d is correctly received, send ACK!\n", seq);
-        }
-    }
-
-    ackpkt.seqnum = B_nextseqnum;
-    B_nextseqnum = (B_nextseqnum + 1) % 2;
-    ackpkt.acknum = seq;
-
-    for (i = 0; i < MAX_PAYLOAD_SIZE; i++) {
-        ackpkt.payload[i] = '0';
-    }
-
-    ackpkt.checksum = ComputeChecksum(ackpkt);
-    tolayer3(B, ackpkt);
-}
-
-
-
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
-{
-    int i;
-    int j;
-
-    expectedseqnum = 0;
-    B_nextseqnum = 1;
-
-    for (i = 0; i < SEQSPACE; i++) {
-        received[i] = false;
-
-        /* Optional: zero out recv_buffer content */
-        recv_buffer[i].seqnum = 0;
-        recv_buffer[i].acknum = 0;
-        recv_buffer[i].checksum = 0;
-        for (j = 0; j < MAX_PAYLOAD_SIZE; j++) {
-            recv_buffer[i].payload[j] = 0;
-        }
-    }
-}
-
-
-/******************************************************************************
- * The following functions need be completed only for bi-directional messages *
- *****************************************************************************/
-
-/* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)  
-{
-}
-
-/* called when B's timer goes off */
-void B_timerinterrupt(void)
-{
-}
-
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "stats.h"
+#include "protocol.h"
+#include "sr.h"
+
+
+
+
+/* ******************************************************************
+   Go Back N protocol.  Adapted from J.F.Kurose
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2  
+
+   Network properties:
+   - one way network delay averages five time units (longer if there
+   are other messages in the channel for GBN), but can be larger
+   - packets can be corrupted (either the header or the data portion)
+   or lost, according to user-defined probabilities
+   - packets will be delivered in the order in which they were sent
+   (although some can be lost).
+
+   Modifications: 
+   - removed bidirectional GBN code and other code not used by prac. 
+   - fixed C style to adhere to current programming style
+   - added GBN implementation
+   - selective repeat for both A and B, so data can flow in both
+   directions, with ACKs piggybacked on data packets
+**********************************************************************/
+
+#ifndef RTT
+#define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
+#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
+#endif
+#define SEQSPACE (2 * WINDOWSIZE)  /* the min sequence space for SR must be at least windowsize *2 */
+#define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#define ACKDELAY 2.0    /* the longest an ACK waits for a data packet to ride on */
+
+/* negative acknowledgements: with NAKS, a receiver NAKs the holes in its
+   window before each new packet it buffers, and the sender resends a
+   NAKed packet at once.  A hole is NAKed again only after NAKREPEAT more
+   packets have arrived beyond it.  A NAK is a pure ACK whose acknum is
+   NAKNUM(seqnum), which is below NOTINUSE */
+#ifndef NAKS
+#define NAKS 0
+#endif
+#ifndef NAKREPEAT
+#define NAKREPEAT 3
+#endif
+#define NAKNUM(seq) (-2 - (seq))
+
+/* deadlines: a packet due to be sent, or sent again, after the deadline
+   of its message is given up on, and so is every packet in flight once
+   its deadline passes, the timer going off for the first of them.  A skip
+   notice goes in its place, with seqnum SKIPNUM(seqnum) and no data,
+   which the receiver ACKs as it would the packet and then passes over.
+   Packets carry the deadline too, and the receiver passes over one it
+   has past the deadline rather than deliver it late.  The parity of FEC
+   covers every packet of a block, so with FEC nothing is given up on */
+#define SKIPNUM(seq) (-2 - (seq))
+
+/* pacing: with PACING, new packets leave through a token bucket rather
+   than as soon as the window has room, so a burst of ACKs does not send
+   a burst of packets to queue up in the medium.  Every PACETICK the
+   bucket gains PACEGAIN times the rate the ACKs have been coming back
+   at, up to PACEBURST tokens, and each new packet takes one.  Resends
+   are not paced */
+#ifndef PACING
+#define PACING 0
+#endif
+#ifndef PACEBURST
+#define PACEBURST 2.0
+#endif
+#define PACETICK 1.0
+#define PACEGAIN 1.25
+#define PACEMIN  (1.0 / RTT)  /* least rate, in packets a time unit */
+
+/* flow control: a receiver holds at most RCVBUF packets, those layer 5
+   has yet to take as well as those out of order, and each packet it sends
+   tells the other side how many more it has room for.  A sender keeps no
+   more packets out than that, but for one to probe a window it has been
+   told is closed, in case the word that it opened was lost */
+#ifndef RCVBUF
+#define RCVBUF WINDOWSIZE
+#endif
+#if RCVBUF < 1 || RCVBUF > WINDOWSIZE
+#error "RCVBUF must be from 1 to WINDOWSIZE"
+#endif
+
+/* streams: every packet carries the stream of its message, and its place
+   in that stream.  With STREAMS > 1 the receiver hands a packet on once
+   those before it in its stream have been, so a lost packet holds back
+   only its own stream.  Streams beyond STREAMS share an order, and with
+   one stream the order is that of the seqnums */
+#ifndef STREAMS
+#define STREAMS 1
+#endif
+
+/* forward error correction: with FEC_PARITY > 0, each block of FEC_DATA
+   data packets, by seqnum, is followed by FEC_PARITY parity packets */
+#ifndef FEC_PARITY
+#define FEC_PARITY 0
+#endif
+#ifndef FEC_DATA
+#define FEC_DATA 4
+#endif
+#if FEC_PARITY > 0
+#if STREAMS > 1
+#error "parity does not cover the stream of a packet, so FEC needs STREAMS 1"
+#endif
+#if SEQSPACE % FEC_DATA != 0 || FEC_DATA > WINDOWSIZE || FEC_DATA + FEC_PARITY > 255
+#error "FEC_DATA must divide SEQSPACE and be no more than WINDOWSIZE"
+#endif
+#define NBLOCKS (SEQSPACE / FEC_DATA)
+#endif
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+
+
+static int ComputeChecksum(struct pkt packet)
+{
+  int checksum = 0;
+  int i;
+
+  checksum = packet.connid;
+  checksum += packet.seqnum;
+  checksum += packet.acknum;
+  checksum += packet.seqepoch;
+  checksum += packet.ackepoch;
+  checksum += packet.window;
+  checksum += packet.inorder;
+  checksum += packet.stream;
+  checksum += packet.streamseq;
+  checksum += (int)packet.deadline;
+  for ( i=0; i<20; i++ ) 
+    checksum += (int)(packet.payload[i]);
+
+  return checksum;
+}
+
+static bool IsCorrupted(struct pkt packet)
+{
+  if (packet.checksum == ComputeChecksum(packet))
+    return (false);
+  else
+    return (true);
+}
+
+
+
+static bool InWindow(int seq, int base, int window_size) {
+  if (base + window_size < SEQSPACE) {
+      return seq >= base && seq < base + window_size;
+  } else {
+      return seq >= base || seq < (base + window_size) % SEQSPACE;
+  }
+}
+
+/* Packets carry the epoch of their seqnum and acknum, the times the
+   sequence numbers had gone round, so that a copy the medium held back
+   from an earlier time round is not taken for the packet now using its
+   number.  This is the epoch of seq, no more than SEQSPACE-1 past base
+   whose epoch is baseepoch */
+static int EpochAt(int seq, int base, int baseepoch)
+{
+  return seq >= base ? baseepoch : baseepoch + 1;
+}
+
+
+/********* Forward error correction ************/
+/* A Reed-Solomon code over GF(2^8), byte by byte on the payloads.  Parity
+   packet j of a block is the sum over its data packets i of Coef(j,i)
+   times their payloads.  The coefficients are a Cauchy matrix with each
+   column scaled to make the first row all ones, so every square part of
+   it is invertible: any FEC_PARITY packets of a block can be rebuilt from
+   as many parity packets, and with one parity packet the code is XOR.
+
+   A parity packet has seqnum SEQSPACE*(1+j) + the seqnum the block
+   starts at, and no seqnum of data is that large. */
+
+#if FEC_PARITY > 0
+static unsigned char gfexp[512], gflog[256];
+
+static void GFInit(void)
+{
+  int i, x = 1;
+
+  for (i = 0; i < 255; i++) {
+    gfexp[i] = gfexp[i + 255] = x;
+    gflog[x] = i;
+    x <<= 1;
+    if (x & 0x100)
+      x ^= 0x11d;
+  }
+}
+
+static unsigned char GFMul(unsigned char a, unsigned char b)
+{
+  return a && b ? gfexp[gflog[a] + gflog[b]] : 0;
+}
+
+static unsigned char GFDiv(unsigned char a, unsigned char b)
+{
+  return a ? gfexp[gflog[a] + 255 - gflog[b]] : 0;
+}
+
+/* 1/(x_j + y_i) over 1/(x_0 + y_i), with x_j = j and y_i = FEC_PARITY + i */
+static unsigned char Coef(int j, int i)
+{
+  return GFDiv(FEC_PARITY + i, j ^ (FEC_PARITY + i));
+}
+
+/* add c times a payload to sum */
+static void AddScaled(unsigned char sum[20], unsigned char c, const char payload[20])
+{
+  int b;
+
+  for (b = 0; b < 20; b++)
+    sum[b] ^= GFMul(c, (unsigned char)payload[b]);
+}
+#endif
+
+
+/********* Sender variables and functions ************/
+/* Both A and B of every flow have a sender and a receiver, found with
+   STATE(AorB).  With simplex transfer only A's sender and B's receiver
+   are used. */
+
+#define STATE(AorB) (2*current_flow + (AorB))
+
+/* The window is kept as parallel arrays indexed by slot, so that ACK
+   processing and the timeout read only the small fields they need and
+   the payloads stay out of their way.  A packet's slot follows from how
+   far its seqnum is past the oldest one's, with no search. */
+struct sender {
+  int seqnum[WINDOWSIZE];           /* of the packet in each slot */
+  int epoch[WINDOWSIZE];            /*   and the epoch of that */
+  bool acked[WINDOWSIZE];           /* whether it has been ACKed */
+  unsigned char resent[WINDOWSIZE]; /* times it has been resent */
+  int stream[WINDOWSIZE];           /* its stream, and its place there */
+  int streamseq[WINDOWSIZE];
+  double deadline[WINDOWSIZE];      /* of its message, 0 for none */
+  bool abandoned[WINDOWSIZE];       /* given up on past the deadline */
+  char payload[WINDOWSIZE][20];
+  int windowfirst, windowlast;    /* slots of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int unsent;                     /* of those, the last ones still waiting to be sent */
+  int rwnd;                       /* room the receiver last said it had */
+  int rwndfrom;                   /*   and the packets it had had in order then */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  int nextepoch;                  /*   and its epoch */
+  int timer_packet;               /* the seqnum of the packet currently being timed */
+  double resenddue;               /* when it is to be resent */
+  bool early;                     /* the timer is set for a deadline before that */
+  double wake;                    /*   which is this one */
+  int nextstreamseq[STREAMS];     /* the place of the next packet of each stream */
+#if FEC_PARITY > 0
+  unsigned char parity[FEC_PARITY][20];  /* of the block being sent */
+#endif
+#if PACING
+  double tokens;                  /* in the bucket */
+  double rate;                    /* estimated ACKs a time unit */
+  int acks;                       /* new ACKs since the last tick */
+  bool pacing;                    /* the pacing timer is running */
+#endif
+};
+
+static struct sender *snd;  /* indexed by STATE(A or B) */
+
+static int TakePendingAck(int AorB, int *epoch);
+static void Advertise(int AorB, struct pkt *packet);
+
+/* send a data packet, carrying any ACK waiting to go the other way */
+static void SendData(int AorB, struct pkt *packet)
+{
+  packet->connid = current_flow;
+  packet->acknum = TakePendingAck(AorB, &packet->ackepoch);
+  Advertise(AorB, packet);
+  packet->checksum = ComputeChecksum(*packet);
+  tolayer3(AorB, *packet);
+}
+
+#if FEC_PARITY > 0
+/* add a new data packet to the parity of its block, and send the parity
+   packets once the block is complete */
+static void SendParity(int AorB, struct pkt *packet)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  struct pkt paritypkt;
+  int i = packet->seqnum % FEC_DATA;
+  int j, b;
+
+  for (j = 0; j < FEC_PARITY; j++) {
+    if (i == 0)
+      for (b = 0; b < 20; b++)
+        s->parity[j][b] = 0;
+    AddScaled(s->parity[j], Coef(j, i), packet->payload);
+  }
+  if (i < FEC_DATA - 1)
+    return;
+  for (j = 0; j < FEC_PARITY; j++) {
+    paritypkt.seqnum = SEQSPACE * (1 + j) + packet->seqnum - i;
+    paritypkt.seqepoch = packet->seqepoch;
+    paritypkt.stream = 0;
+    paritypkt.streamseq = 0;
+    paritypkt.deadline = 0.0;
+    for (b = 0; b < 20; b++)
+      paritypkt.payload[b] = s->parity[j][b];
+    if (TRACE > 0)
+      printf("----%c: sending parity packet %d of block %d\n", 'A' + AorB, j, packet->seqnum - i);
+    SendData(AorB, &paritypkt);
+    COUNT(AorB, C_FEC_PARITY);
+  }
+}
+#endif
+
+/* the slot of a packet in the window, given its seqnum */
+static int Slot(struct sender *s, int seq)
+{
+  return (s->windowfirst + (seq - s->seqnum[s->windowfirst] + SEQSPACE) % SEQSPACE) % WINDOWSIZE;
+}
+
+/* the deadline of the packet in a slot of the window, 0 for none */
+static double Deadline(struct sender *s, int index)
+{
+#if FEC_PARITY > 0
+  return 0.0;
+#else
+  return s->deadline[index];
+#endif
+}
+
+/* whether the packet in a slot of the window is past its deadline */
+static bool Expired(struct sender *s, int index)
+{
+  return Deadline(s, index) > 0.0 && Deadline(s, index) <= currenttime();
+}
+
+/* give up on the packet in a slot, and send a skip notice for it */
+static void SendSkip(int AorB, struct sender *s, int index)
+{
+  struct pkt packet;
+  int i;
+
+  if (!s->abandoned[index]) {
+    s->abandoned[index] = true;
+    COUNT(AorB, C_EXPIRED);
+  }
+  if (TRACE > 0)
+    printf("----%c: packet %d is past its deadline, send skip!\n", 'A' + AorB, s->seqnum[index]);
+  packet.seqnum = SKIPNUM(s->seqnum[index]);
+  packet.seqepoch = s->epoch[index];
+  packet.stream = s->stream[index];
+  packet.streamseq = s->streamseq[index];
+  packet.deadline = 0.0;
+  for (i=0; i<20; i++)
+    packet.payload[i] = '0';
+  SendData(AorB, &packet);
+}
+
+/* send the packet in a slot of the window again */
+static void Resend(int AorB, struct sender *s, int index)
+{
+  struct pkt packet;
+  int i;
+
+  if (s->abandoned[index] || Expired(s, index)) {
+    SendSkip(AorB, s, index);
+    return;
+  }
+  packet.seqnum = s->seqnum[index];
+  packet.seqepoch = s->epoch[index];
+  packet.stream = s->stream[index];
+  packet.streamseq = s->streamseq[index];
+  packet.deadline = Deadline(s, index);
+  for (i=0; i<20; i++)
+    packet.payload[i] = s->payload[index][i];
+  SendData(AorB, &packet);
+  if (s->resent[index] < 255)
+    s->resent[index]++;
+  COUNT(AorB, C_PACKETS_RESENT);
+}
+
+/* set the timer for delay, or for the first deadline of a packet in
+   flight if that comes sooner */
+static void ArmTimer(int AorB, struct sender *s, double delay)
+{
+  double now = currenttime(), d;
+  int i, index;
+
+  s->early = false;
+  for (i = 0; i < s->windowcount - s->unsent; i++) {
+    index = (s->windowfirst + i) % WINDOWSIZE;
+    d = Deadline(s, index);
+    if (!s->acked[index] && !s->abandoned[index] && d > 0.0 && d - now < delay) {
+      delay = d > now ? d - now : 0.0;
+      s->early = true;
+      s->wake = d;
+    }
+  }
+  starttimer(AorB, delay);
+}
+
+/* time the timed packet afresh, to be resent in RTT */
+static void StartTimer(int AorB, struct sender *s)
+{
+  s->resenddue = currenttime() + RTT;
+  ArmTimer(AorB, s, RTT);
+}
+
+/* send the first packet of the window still waiting to be sent */
+static void SendNew(int AorB, struct sender *s)
+{
+  struct pkt sendpkt;
+  int index = (s->windowlast - s->unsent + 1 + WINDOWSIZE) % WINDOWSIZE;
+  int i;
+
+  sendpkt.seqnum = s->seqnum[index];
+  sendpkt.seqepoch = s->epoch[index];
+  sendpkt.stream = s->stream[index];
+  sendpkt.streamseq = s->streamseq[index];
+  sendpkt.deadline = Deadline(s, index);
+  for (i=0; i<20; i++)
+    sendpkt.payload[i] = s->payload[index][i];
+  s->unsent--;
+
+  if (Expired(s, index))
+    SendSkip(AorB, s, index);
+  else {
+    /* send out packet */
+    if (TRACE > 0)
+      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
+    SendData(AorB, &sendpkt);
+#if FEC_PARITY > 0
+    SendParity(AorB, &sendpkt);
+#endif
+  }
+
+  /* if this is the only unACKed packet, start the timer */
+  if (s->timer_packet == NOTINUSE) {
+    s->timer_packet = sendpkt.seqnum;
+    StartTimer(AorB, s);
+  }
+}
+
+/* whether the receiver has room for another packet */
+static bool Receivable(struct sender *s)
+{
+  int inflight = s->windowcount - s->unsent;
+
+  return inflight == 0 || inflight < s->rwnd;
+}
+
+/* send the packets waiting in the window, as far as the receiver's
+   window, and with PACING the tokens, let them */
+static void SendWaiting(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+
+  while (s->unsent > 0 && Receivable(s)) {
+#if PACING
+    if (s->tokens < 1.0)
+      break;
+    s->tokens -= 1.0;
+#endif
+    SendNew(AorB, s);
+  }
+#if PACING
+  if (s->windowcount > 0 && !s->pacing) {
+    startpacetimer(AorB, PACETICK);
+    s->pacing = true;
+  }
+#endif
+}
+
+#if PACING
+
+/* called when the pacing timer of AorB goes off: estimate the rate from
+   the ACKs, which only measure the path while there is data out, and
+   fill the bucket.  An idle sender's bucket is left full */
+static void PaceTimerInterrupt(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+
+  s->pacing = false;
+  if (s->windowcount == 0) {
+    s->tokens = PACEBURST;
+    s->acks = 0;
+    return;
+  }
+  s->rate += (s->acks / PACETICK - s->rate) / 16;
+  if (s->rate < PACEMIN)
+    s->rate = PACEMIN;
+  s->acks = 0;
+  s->tokens += PACEGAIN * s->rate * PACETICK;
+  if (s->tokens > PACEBURST)
+    s->tokens = PACEBURST;
+  SendWaiting(AorB);
+}
+#endif
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void Output(int AorB, struct msg message)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  int i;
+
+  /* if not blocked waiting on ACK */
+  if (s->windowcount < WINDOWSIZE) {
+    if (TRACE > 1)
+      printf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", 'A' + AorB);
+
+    /* put packet in window buffer */
+    s->windowlast = (s->windowlast + 1) % WINDOWSIZE; 
+    s->windowcount++;
+    s->unsent++;
+    s->seqnum[s->windowlast] = s->nextseqnum;
+    s->epoch[s->windowlast] = s->nextepoch;
+    s->acked[s->windowlast] = false;
+    s->resent[s->windowlast] = 0;
+    s->stream[s->windowlast] = message.stream;
+    s->deadline[s->windowlast] = message.deadline;
+    s->abandoned[s->windowlast] = false;
+    s->streamseq[s->windowlast] = s->nextstreamseq[message.stream % STREAMS]++;
+    for (i=0; i<20; i++)
+      s->payload[s->windowlast][i] = message.data[i];
+
+    /* get next sequence number, wrap back to 0 */
+    s->nextseqnum = (s->nextseqnum + 1) % SEQSPACE;  
+    if (s->nextseqnum == 0)
+      s->nextepoch++;
+
+    if (!Receivable(s)) {
+      if (TRACE > 0)
+        printf("----%c: packet %d waits for the receiver's window\n", 'A' + AorB, s->seqnum[s->windowlast]);
+      COUNT(AorB, C_WINDOW_CLOSED);
+    }
+#if PACING
+    else if (s->unsent > s->tokens) {
+      if (TRACE > 0)
+        printf("----%c: packet %d waits for the pacer\n", 'A' + AorB, s->seqnum[s->windowlast]);
+      COUNT(AorB, C_PACED);
+    }
+#endif
+    SendWaiting(AorB);
+  }
+  /* if blocked,  window is full */
+  else {
+    if (TRACE > 0)
+      printf("----%c: New message arrives, send window is full\n", 'A' + AorB);
+    COUNT(AorB, C_WINDOW_FULL);
+  }
+}
+
+/* an uncorrupted ACK (pure or piggybacked) has arrived at AorB */
+static void AckInput(int AorB, int acknum, int epoch)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  int i;
+
+  if (TRACE > 0)
+    printf("----%c: uncorrupted ACK %d is received\n", 'A' + AorB, acknum);
+  COUNT(AorB, C_ACKS_RECEIVED);
+
+  /* an ACK outside the window, or of another epoch, is left over from an
+     earlier pass through the sequence space */
+  if (s->windowcount == s->unsent || !InWindow(acknum, s->seqnum[s->windowfirst], s->windowcount - s->unsent)
+      || s->acked[Slot(s, acknum)] || s->epoch[Slot(s, acknum)] != epoch) {
+    if (TRACE > 0)
+      printf("----%c: duplicate ACK received, do nothing!\n", 'A' + AorB);
+    return;
+  }
+
+  if (TRACE > 0)
+    printf("----%c: ACK %d is not a duplicate\n", 'A' + AorB, acknum);
+  COUNT(AorB, C_NEW_ACKS);
+  s->acked[Slot(s, acknum)] = true;
+#if PACING
+  s->acks++;
+#endif
+
+  /* slide window forward */
+  while (s->windowcount > 0 && s->acked[s->windowfirst]) {
+    s->windowfirst = (s->windowfirst + 1) % WINDOWSIZE;
+    s->windowcount--;
+  }
+
+  /* reassign timer if this was the packet being timed */
+  if (acknum == s->timer_packet) {
+    stoptimer(AorB);
+    s->timer_packet = NOTINUSE;
+
+    /* find next unACKed packet in the window */
+    for (i = 0; i < s->windowcount - s->unsent; i++) {
+      int index = (s->windowfirst + i) % WINDOWSIZE;
+      if (!s->acked[index]) {
+        s->timer_packet = s->seqnum[index];
+        StartTimer(AorB, s);
+        if (TRACE > 0)
+          printf("----%c: Timer now set for packet %d\n", 'A' + AorB, s->timer_packet);
+        break;
+      }
+    }
+  }
+}
+
+#if NAKS
+/* a NAK has arrived at AorB: resend the packet now rather than at the timeout */
+static void NakInput(int AorB, int seq, int epoch)
+{
+  struct sender *s = &snd[STATE(AorB)];
+
+  if (s->windowcount == s->unsent || !InWindow(seq, s->seqnum[s->windowfirst], s->windowcount - s->unsent)
+      || s->acked[Slot(s, seq)] || s->epoch[Slot(s, seq)] != epoch) {
+    if (TRACE > 0)
+      printf("----%c: NAK %d for a packet already ACKed, do nothing!\n", 'A' + AorB, seq);
+    return;
+  }
+  if (TRACE > 0)
+    printf("----%c: NAK %d is received, resend packet!\n", 'A' + AorB, seq);
+  Resend(AorB, s, Slot(s, seq));
+  COUNT(AorB, C_NAK_RESENDS);
+  /* the resend gets a full RTT before the timeout sends it yet again */
+  if (seq == s->timer_packet) {
+    stoptimer(AorB);
+    StartTimer(AorB, s);
+  }
+}
+#endif
+
+/* called when the retransmission timer of AorB goes off */
+static void TimerInterrupt(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  double now = currenttime();
+  int i, index;
+
+  if (TRACE > 0)
+    printf("----%c: time out,resend packets!\n", 'A' + AorB);
+
+  if (s->timer_packet == NOTINUSE)
+    return;
+
+  /* the timed packet is the oldest unACKed one */
+  if (!s->early && s->windowcount > 0 &&
+      InWindow(s->timer_packet, s->seqnum[s->windowfirst], s->windowcount)) {
+    if (TRACE > 0)
+      printf("---%c: resending packet %d\n", 'A' + AorB, s->timer_packet);
+    Resend(AorB, s, Slot(s, s->timer_packet));
+  }
+
+  /* give up on the packets in flight past their deadlines; the one the
+     timer was set for is, whatever the rounding of the time */
+  if (s->early && s->wake > now)
+    now = s->wake;
+  for (i = 0; i < s->windowcount - s->unsent; i++) {
+    index = (s->windowfirst + i) % WINDOWSIZE;
+    if (!s->acked[index] && !s->abandoned[index] && Deadline(s, index) > 0.0 &&
+        Deadline(s, index) <= now)
+      SendSkip(AorB, s, index);
+  }
+
+  if (s->early)
+    ArmTimer(AorB, s, s->resenddue - currenttime());
+  else
+    StartTimer(AorB, s);
+}
+
+static void SenderInit(int AorB)
+{
+  struct sender *s = &snd[STATE(AorB)];
+  int i;
+
+  /* initialise the window, buffer and sequence number */
+  s->nextseqnum = 0;  /* starts with seq num 0, do not change this */
+  s->nextepoch = 0;
+  s->windowfirst = 0;
+  s->windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+		     new packets are placed in winlast + 1 
+		     so initially this is set to -1
+		   */
+  s->windowcount = 0;
+  s->unsent = 0;
+  s->rwnd = RCVBUF;
+  s->rwndfrom = 0;
+  s->timer_packet = NOTINUSE;
+  s->early = false;
+#if PACING
+  s->tokens = PACEBURST;
+  s->rate = WINDOWSIZE / RTT;
+  s->acks = 0;
+  s->pacing = false;
+#endif
+  for (i = 0; i < WINDOWSIZE; i++) {
+    s->seqnum[i] = 0;
+    s->epoch[i] = 0;
+    s->acked[i] = false;
+    s->resent[i] = 0;
+    s->abandoned[i] = false;
+  }
+  for (i = 0; i < STREAMS; i++)
+    s->nextstreamseq[i] = 0;
+}
+
+
+/********* Receiver variables and procedures ************/
+
+struct receiver {
+  int expectedseqnum;                /* base of receiver window */
+  int epoch;                         /*   and its epoch */
+  int readseq;                       /* first packet layer 5 has not yet taken */
+  int advertised;                    /* room last told to the other side */
+  bool received[SEQSPACE];           /* to track which packets are received */
+  bool skipped[SEQSPACE];            /*   and which of them were only skip notices */
+  char payload[SEQSPACE][20];        /* of the out-of-order packets */
+  int stream[SEQSPACE];              /*   and their streams */
+  double deadline[SEQSPACE];         /*   and deadlines */
+#if STREAMS > 1
+  int streamseq[SEQSPACE];           /*   and places in them */
+  bool handed[SEQSPACE];             /* next in its stream when it came, so handed on */
+  bool taken[SEQSPACE];              /* taken by layer 5 */
+  int ready[SEQSPACE];               /* the packets handed on but not yet taken, in turn */
+  int readyfirst, readycount;
+  int nextstreamseq[STREAMS];        /* the place of the next packet to hand on */
+#endif
+#if NAKS
+  unsigned char nakwait[SEQSPACE];   /* arrivals until a hole may be NAKed again */
+#endif
+#if FEC_PARITY > 0
+  bool hasparity[NBLOCKS][FEC_PARITY];          /* parity packets received for */
+  char parity[NBLOCKS][FEC_PARITY][20];         /*   each block not yet delivered */
+#endif
+  int pendingack;                    /* ACK waiting for a data packet to ride on */
+  int pendingepoch;                  /*   and the epoch it ACKs */
+};
+
+static struct receiver *rcv;  /* indexed by STATE(A or B) */
+
+/* tell the other side, in the next packet sent, of the room in the
+   receive buffer beyond the packets delivered in order, and how many of
+   those there have been */
+static void Advertise(int AorB, struct pkt *packet)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  r->advertised = RCVBUF - (r->expectedseqnum - r->readseq + SEQSPACE) % SEQSPACE;
+  packet->window = r->advertised;
+  packet->inorder = r->epoch * SEQSPACE + r->expectedseqnum;
+}
+
+/* send an ACK now as a packet of its own, of a packet of the epoch.
+   With NOTINUSE it only tells the other side the room there is */
+static void SendPureAck(int AorB, int acknum, int epoch)
+{
+  struct pkt ackpkt;
+  int i;
+
+  ackpkt.connid = current_flow;
+  ackpkt.seqnum = NOTINUSE;  /* no data in this packet */
+  ackpkt.acknum = acknum;
+  ackpkt.seqepoch = 0;
+  ackpkt.ackepoch = epoch;
+  Advertise(AorB, &ackpkt);
+  ackpkt.stream = 0;
+  ackpkt.streamseq = 0;
+  ackpkt.deadline = 0.0;
+  for (i = 0; i < 20; i++)
+    ackpkt.payload[i] = '0';
+  ackpkt.checksum = ComputeChecksum(ackpkt);
+  tolayer3(AorB, ackpkt);
+}
+
+#if NAKS
+/* NAK the holes in the window before seq, each no more than once in
+   NAKREPEAT arrivals beyond it.  NAKs are never held back */
+static void SendNaks(int AorB, int seq)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int h;
+
+  for (h = r->expectedseqnum; h != seq; h = (h + 1) % SEQSPACE) {
+    if (r->received[h])
+      continue;
+    if (r->nakwait[h] > 0) {
+      r->nakwait[h]--;
+      continue;
+    }
+    if (TRACE > 0)
+      printf("----%c: packet %d is missing, send NAK!\n", 'A' + AorB, h);
+    SendPureAck(AorB, NAKNUM(h), EpochAt(h, r->expectedseqnum, r->epoch));
+    COUNT(AorB, C_NAKS_SENT);
+    r->nakwait[h] = NAKREPEAT;
+  }
+}
+#endif
+
+/* ACK a received packet of the epoch.  With bidirectional transfer the
+   ACK is held back for up to ACKDELAY in the hope that a data packet
+   leaves first. */
+static void SendAck(int AorB, int acknum, int epoch)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  if (!bidirectional) {
+    SendPureAck(AorB, acknum, epoch);
+    return;
+  }
+  /* each ACK names one packet, so an earlier ACK still waiting must go now */
+  if (r->pendingack != NOTINUSE) {
+    stopacktimer(AorB);
+    SendPureAck(AorB, r->pendingack, r->pendingepoch);
+  }
+  r->pendingack = acknum;
+  r->pendingepoch = epoch;
+  startacktimer(AorB, ACKDELAY);
+}
+
+/* remove and return the ACK waiting to be piggybacked, if any, and set
+   epoch to the epoch it ACKs */
+static int TakePendingAck(int AorB, int *epoch)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int acknum = r->pendingack;
+
+  *epoch = r->pendingepoch;
+  if (acknum != NOTINUSE) {
+    stopacktimer(AorB);
+    r->pendingack = NOTINUSE;
+  }
+  return acknum;
+}
+
+/* called when the delayed ACK timer of AorB goes off */
+static void AckTimerInterrupt(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+
+  if (r->pendingack != NOTINUSE) {
+    SendPureAck(AorB, r->pendingack, r->pendingepoch);
+    r->pendingack = NOTINUSE;
+  }
+}
+
+/* whether layer 5 is told of a gap in place of the message in a slot:
+   the sender gave up on it, or its deadline has passed */
+static bool PassOver(struct receiver *r, int seq)
+{
+  return r->skipped[seq] || (r->deadline[seq] > 0.0 && r->deadline[seq] <= currenttime());
+}
+
+#if STREAMS > 1
+/* give layer 5 as many of the packets handed on as it has room for */
+static void Read(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  struct msg run[WINDOWSIZE];   /* messages delivered together */
+  int i, n, room, seq;
+
+  while (r->readycount > 0) {
+    seq = r->ready[r->readyfirst];
+    if (PassOver(r, seq)) {
+      /* layer 5 learns of the gap in place of the message */
+      if (!r->skipped[seq])
+        COUNT(AorB, C_LATE);
+      tolayer5_lost(AorB, r->stream[seq]);
+      GAUGE_ADD(G_RCVBUFFERED, -1);
+      r->taken[seq] = true;
+      r->readyfirst = (r->readyfirst + 1) % SEQSPACE;
+      r->readycount--;
+      continue;
+    }
+    if ((room = tolayer5_room(AorB)) == 0)
+      break;
+    for (n=0; n < room && r->readycount > 0 && !PassOver(r, r->ready[r->readyfirst]); n++) {
+      seq = r->ready[r->readyfirst];
+      for (i=0; i<20; i++)
+        run[n].data[i] = r->payload[seq][i];
+      run[n].stream = r->stream[seq];
+      r->taken[seq] = true;
+      r->readyfirst = (r->readyfirst + 1) % SEQSPACE;
+      r->readycount--;
+    }
+    GAUGE_ADD(G_RCVBUFFERED, -n);
+    tolayer5_batch(AorB, run, n);
+  }
+  /* the buffer is free up to the first packet not yet taken */
+  while (r->readseq != r->expectedseqnum && r->taken[r->readseq]) {
+    r->taken[r->readseq] = false;
+    r->readseq = (r->readseq + 1) % SEQSPACE;
+  }
+#else
+/* give layer 5 as many of the packets delivered in order as it has room for */
+static void Read(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  struct msg run[WINDOWSIZE];   /* in order messages, delivered together */
+  int i, n, room;
+
+  while (r->readseq != r->expectedseqnum) {
+    if (PassOver(r, r->readseq)) {
+      /* layer 5 learns of the gap in place of the message */
+      if (!r->skipped[r->readseq])
+        COUNT(AorB, C_LATE);
+      tolayer5_lost(AorB, r->stream[r->readseq]);
+      GAUGE_ADD(G_RCVBUFFERED, -1);
+      r->readseq = (r->readseq + 1) % SEQSPACE;
+      continue;
+    }
+    if ((room = tolayer5_room(AorB)) == 0)
+      break;
+    for (n=0; n < room && r->readseq != r->expectedseqnum && !PassOver(r, r->readseq); n++) {
+      for (i=0; i<20; i++)
+        run[n].data[i] = r->payload[r->readseq][i];
+      run[n].stream = r->stream[r->readseq];
+      r->readseq = (r->readseq + 1) % SEQSPACE;
+    }
+    GAUGE_ADD(G_RCVBUFFERED, -n);
+    tolayer5_batch(AorB, run, n);
+  }
+#endif
+  /* a sender told there was no room waits to hear that there is */
+  if (r->advertised == 0 && (r->expectedseqnum - r->readseq + SEQSPACE) % SEQSPACE < RCVBUF) {
+    if (TRACE > 0)
+      printf("----%c: receive buffer has room again, tell the sender!\n", 'A' + AorB);
+    SendPureAck(AorB, NOTINUSE, 0);
+  }
+}
+
+#if STREAMS > 1
+/* hand on the packets that are next in their streams.  Those before the
+   window have all come, and been handed on in turn, so the next of a
+   stream is its first in the window not yet handed on, if it has come */
+static void HandOn(struct receiver *r)
+{
+  int lane, i, seq;
+
+  for (lane = 0; lane < STREAMS; lane++)
+    for (i = 0; i < WINDOWSIZE; i++) {
+      seq = (r->expectedseqnum + i) % SEQSPACE;
+      if (!r->received[seq] || r->handed[seq] || r->stream[seq] % STREAMS != lane)
+        continue;
+      if (r->streamseq[seq] != r->nextstreamseq[lane])
+        break;
+      r->handed[seq] = true;
+      r->nextstreamseq[lane]++;
+      r->ready[(r->readyfirst + r->readycount++) % SEQSPACE] = seq;
+    }
+}
+#endif
+
+/* move the window past any run of in order packets, and hand them on.
+   With streams, only past those handed on: a packet the window has
+   passed is taken to have gone to its stream */
+static void Deliver(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+#if FEC_PARITY > 0
+  int i;
+#endif
+
+#if STREAMS > 1
+  HandOn(r);
+  while (r->received[r->expectedseqnum] && r->handed[r->expectedseqnum]) {
+#else
+  while (r->received[r->expectedseqnum]) {
+#endif
+    r->received[r->expectedseqnum] = false;
+#if STREAMS > 1
+    r->handed[r->expectedseqnum] = false;
+#endif
+#if NAKS
+    r->nakwait[r->expectedseqnum] = 0;
+#endif
+    r->expectedseqnum = (r->expectedseqnum + 1) % SEQSPACE;
+    if (r->expectedseqnum == 0)
+      r->epoch++;
+#if FEC_PARITY > 0
+    /* a block all delivered needs its parity no more */
+    if (r->expectedseqnum % FEC_DATA == 0)
+      for (i = 0; i < FEC_PARITY; i++)
+        r->hasparity[(r->expectedseqnum + SEQSPACE - 1) % SEQSPACE / FEC_DATA][i] = false;
+#endif
+  }
+  Read(AorB);
+}
+
+#if FEC_PARITY > 0
+/* rebuild the missing packets of a block, if there is parity enough.  The
+   packets of the block before expectedseqnum have been delivered, but
+   their payloads are still in the buffer */
+static void Recover(int AorB, int block)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  unsigned char m[FEC_PARITY][FEC_PARITY], x[FEC_PARITY][20], t[20], c;
+  int rows[FEC_PARITY], missing[FEC_PARITY];
+  bool known[FEC_DATA];
+  int first = block * FEC_DATA, nrows = 0, nmissing = 0;
+  int i, j, k, q, b;
+
+  for (j = 0; j < FEC_PARITY; j++)
+    if (r->hasparity[block][j])
+      rows[nrows++] = j;
+  for (i = 0; i < FEC_DATA; i++) {
+    known[i] = r->received[first + i] || !InWindow(first + i, r->expectedseqnum, WINDOWSIZE);
+    if (!known[i]) {
+      if (nmissing == nrows)
+        return;         /* more missing than there is parity for */
+      missing[nmissing++] = i;
+    }
+  }
+  if (nmissing == 0)
+    return;
+
+  /* each parity packet less the part the known packets make of it, equal
+     to the missing packets times their coefficients */
+  for (k = 0; k < nmissing; k++) {
+    for (b = 0; b < 20; b++)
+      x[k][b] = r->parity[block][rows[k]][b];
+    for (i = 0; i < FEC_DATA; i++)
+      if (known[i])
+        AddScaled(x[k], Coef(rows[k], i), r->payload[first + i]);
+    for (q = 0; q < nmissing; q++)
+      m[k][q] = Coef(rows[k], missing[q]);
+  }
+
+  /* solve by Gauss-Jordan elimination; the matrix is invertible */
+  for (k = 0; k < nmissing; k++) {
+    for (q = k; m[q][k] == 0; q++)
+      ;
+    for (j = 0; j < nmissing; j++) {
+      c = m[q][j]; m[q][j] = m[k][j]; m[k][j] = c;
+    }
+    for (b = 0; b < 20; b++) {
+      t[b] = x[q][b]; x[q][b] = x[k][b]; x[k][b] = t[b];
+    }
+    c = m[k][k];
+    for (j = 0; j < nmissing; j++)
+      m[k][j] = GFDiv(m[k][j], c);
+    for (b = 0; b < 20; b++)
+      x[k][b] = GFDiv(x[k][b], c);
+    for (q = 0; q < nmissing; q++)
+      if (q != k && (c = m[q][k]) != 0) {
+        for (j = 0; j < nmissing; j++)
+          m[q][j] ^= GFMul(c, m[k][j]);
+        for (b = 0; b < 20; b++)
+          x[q][b] ^= GFMul(c, x[k][b]);
+      }
+  }
+
+  for (k = 0; k < nmissing; k++) {
+    i = first + missing[k];
+    if (TRACE > 0)
+      printf("----%c: packet %d is rebuilt from parity, send ACK!\n", 'A' + AorB, i);
+    for (b = 0; b < 20; b++)
+      r->payload[i][b] = x[k][b];
+    r->stream[i] = 0;         /* the parity does not cover it */
+    r->deadline[i] = 0.0;
+    r->skipped[i] = false;
+    r->received[i] = true;
+    GAUGE_ADD(G_RCVBUFFERED, 1);
+    COUNT(AorB, C_FEC_RECOVERED);
+    SendAck(AorB, i, EpochAt(i, r->expectedseqnum, r->epoch));
+  }
+}
+
+/* a parity packet has arrived at AorB */
+static void ParityInput(int AorB, struct pkt packet)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int j = packet.seqnum / SEQSPACE - 1;
+  int first = packet.seqnum % SEQSPACE;
+  int b;
+
+  /* a block with its last packet delivered is done with, and a block of
+     another epoch was done with long ago */
+  if (j >= FEC_PARITY || !InWindow(first + FEC_DATA - 1, r->expectedseqnum, WINDOWSIZE) ||
+      packet.seqepoch != EpochAt(first + FEC_DATA - 1, r->expectedseqnum, r->epoch)) {
+    if (TRACE > 0)
+      printf("----%c: parity for block %d is not needed\n", 'A' + AorB, first);
+    return;
+  }
+  for (b = 0; b < 20; b++)
+    r->parity[first / FEC_DATA][j][b] = packet.payload[b];
+  r->hasparity[first / FEC_DATA][j] = true;
+  Recover(AorB, first / FEC_DATA);
+  Deliver(AorB);
+}
+#endif
+
+/* a data packet, or a skip notice, has arrived at AorB */
+static void DataInput(int AorB, struct pkt packet, bool skip)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int seq = skip ? SKIPNUM(packet.seqnum) : packet.seqnum;
+  /* a copy the medium held back from an earlier epoch was delivered then */
+  bool inwindow = InWindow(seq, r->expectedseqnum, WINDOWSIZE) &&
+                  packet.seqepoch == EpochAt(seq, r->expectedseqnum, r->epoch);
+  int i;
+
+  if (!skip)
+    COUNT(AorB, C_PACKETS_RECEIVED);
+
+  if (inwindow && !InWindow(seq, r->readseq, RCVBUF)) {
+    /* the sender went beyond the window it was told of, or was probing it */
+    if (TRACE > 0)
+      printf("----%c: no room for packet %d in the receive buffer, drop it!\n", 'A' + AorB, seq);
+    COUNT(AorB, C_RCVBUF_FULL);
+    SendPureAck(AorB, NOTINUSE, 0);
+    return;
+  }
+
+  if (inwindow) {
+    if (!r->received[seq]) {
+      if (TRACE > 0)
+        printf(skip ? "----%c: packet %d is to be passed over, send ACK!\n" :
+               "----%c: packet %d is correctly received, send ACK!\n", 'A' + AorB, seq);
+      if (skip)
+        COUNT(AorB, C_SKIPPED);
+      r->skipped[seq] = skip;
+      for (i=0; i<20; i++)
+        r->payload[seq][i] = packet.payload[i];
+      r->stream[seq] = packet.stream;
+      r->deadline[seq] = packet.deadline;
+#if STREAMS > 1
+      r->streamseq[seq] = packet.streamseq;
+#endif
+      r->received[seq] = true;
+      GAUGE_ADD(G_RCVBUFFERED, 1);
+#if NAKS
+      SendNaks(AorB, seq);
+#endif
+#if FEC_PARITY > 0
+      Recover(AorB, seq / FEC_DATA);
+#endif
+    }
+    else if (!skip)
+      COUNT(AorB, C_SPURIOUS);
+    Deliver(AorB);
+  }
+  else {
+    /* already delivered, the earlier ACK must have been lost, or the
+       medium held a copy back */
+    if (TRACE > 0)
+      printf("----%c: packet %d is correctly received, send ACK!\n", 'A' + AorB, seq);
+    if (!skip)
+      COUNT(AorB, C_SPURIOUS);
+  }
+
+  SendAck(AorB, seq, packet.seqepoch);
+}
+
+static void ReceiverInit(int AorB)
+{
+  struct receiver *r = &rcv[STATE(AorB)];
+  int i;
+
+  r->expectedseqnum = 0;
+  r->epoch = 0;
+  r->readseq = 0;
+  r->advertised = RCVBUF;
+  r->pendingack = NOTINUSE;
+  r->pendingepoch = 0;
+  for (i = 0; i < SEQSPACE; i++)
+    r->received[i] = r->skipped[i] = false;
+#if STREAMS > 1
+  for (i = 0; i < SEQSPACE; i++)
+    r->handed[i] = r->taken[i] = false;
+  for (i = 0; i < STREAMS; i++)
+    r->nextstreamseq[i] = 0;
+  r->readyfirst = r->readycount = 0;
+#endif
+#if NAKS
+  for (i = 0; i < SEQSPACE; i++)
+    r->nakwait[i] = 0;
+#endif
+#if FEC_PARITY > 0
+  for (i = 0; i < NBLOCKS * FEC_PARITY; i++)
+    r->hasparity[i / FEC_PARITY][i % FEC_PARITY] = false;
+#endif
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at AorB */
+static void Input(int AorB, struct pkt packet)
+{
+  if (IsCorrupted(packet)) {
+    COUNT(AorB, C_CORRUPT_RECEIVED);
+    if (TRACE > 0)
+      printf("----%c: corrupted packet is received, do nothing!\n", 'A' + AorB);
+    return;
+  }
+  /* the room told in a packet sent before the one it was last taken from
+     is out of date; one held back in the medium could shut the window */
+  if (packet.inorder >= snd[STATE(AorB)].rwndfrom) {
+    snd[STATE(AorB)].rwnd = packet.window;
+    snd[STATE(AorB)].rwndfrom = packet.inorder;
+  }
+#if NAKS
+  if (packet.acknum < NOTINUSE)
+    NakInput(AorB, -2 - packet.acknum, packet.ackepoch);
+  else
+#endif
+  if (packet.acknum != NOTINUSE)
+    AckInput(AorB, packet.acknum, packet.ackepoch);
+#if FEC_PARITY > 0
+  if (packet.seqnum >= SEQSPACE)
+    ParityInput(AorB, packet);
+  else
+#endif
+  if (packet.seqnum < NOTINUSE)
+    DataInput(AorB, packet, true);
+  else if (packet.seqnum != NOTINUSE)
+    DataInput(AorB, packet, false);
+  /* the ACK, or the room the other side has, may let waiting packets go */
+  SendWaiting(AorB);
+}
+
+
+/********* Entry points called by the emulator ************/
+
+/* the state of every flow is allocated when the first flow is initialised */
+static void AllocState(void)
+{
+  if (snd != NULL)
+    return;
+#if FEC_PARITY > 0
+  GFInit();
+#endif
+  snd = malloc(2*nflows * sizeof(struct sender));
+  rcv = malloc(2*nflows * sizeof(struct receiver));
+  if (snd == NULL || rcv == NULL) {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void A_output(struct msg message)
+{
+  Output(A, message);
+}
+
+static void A_input(struct pkt packet)
+{
+  Input(A, packet);
+}
+
+static void A_timerinterrupt(void)
+{
+  TimerInterrupt(A);
+}
+
+static void A_acktimerinterrupt(void)
+{
+  AckTimerInterrupt(A);
+}
+
+static void A_layer5ready(void)
+{
+  Read(A);
+}
+
+static void A_pacetimerinterrupt(void)
+{
+#if PACING
+  PaceTimerInterrupt(A);
+#endif
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+static void A_init(void)
+{
+  AllocState();
+  SenderInit(A);
+  ReceiverInit(A);
+}
+
+static void B_output(struct msg message)  
+{
+  Output(B, message);
+}
+
+static void B_input(struct pkt packet)
+{
+  Input(B, packet);
+}
+
+static void B_timerinterrupt(void)
+{
+  TimerInterrupt(B);
+}
+
+static void B_acktimerinterrupt(void)
+{
+  AckTimerInterrupt(B);
+}
+
+static void B_layer5ready(void)
+{
+  Read(B);
+}
+
+static void B_pacetimerinterrupt(void)
+{
+#if PACING
+  PaceTimerInterrupt(B);
+#endif
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+static void B_init(void)
+{
+  AllocState();
+  SenderInit(B);
+  ReceiverInit(B);
+}
+
+/********* Checkpoints ************/
+
+/* the sizes of the state go first, so that a checkpoint of another
+   protocol, or of another window size, is refused */
+static void protocol_save(FILE *f)
+{
+  size_t sizes[2] = { sizeof(struct sender), sizeof(struct receiver) };
+
+  fwrite(sizes, sizeof(sizes), 1, f);
+  fwrite(snd, sizeof(struct sender), 2*nflows, f);
+  fwrite(rcv, sizeof(struct receiver), 2*nflows, f);
+}
+
+static int protocol_restore(FILE *f)
+{
+  size_t sizes[2];
+
+  AllocState();
+  return fread(sizes, sizeof(sizes), 1, f) == 1
+         && sizes[0] == sizeof(struct sender) && sizes[1] == sizeof(struct receiver)
+         && fread(snd, sizeof(struct sender), 2*nflows, f) == (size_t)(2*nflows)
+         && fread(rcv, sizeof(struct receiver), 2*nflows, f) == (size_t)(2*nflows);
+}
+
+const struct protocol sr_protocol = {
+  "sr", 0, 1, 1, 1,
+  A_init, B_init,
+  A_input, B_input,
+  A_output, B_output,
+  A_timerinterrupt, B_timerinterrupt,
+  A_acktimerinterrupt, B_acktimerinterrupt,
+  A_pacetimerinterrupt, B_pacetimerinterrupt,
+  A_layer5ready, B_layer5ready,
+  protocol_save, protocol_restore
+};
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#if defined(TIMING) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+#include "stats.h"
+
+_Thread_local long counters[2][NCOUNTERS];
+_Thread_local struct gaugevalue gauges[NGAUGES];
+_Thread_local struct timingvalue timings[NTIMINGS];
+_Thread_local struct runcost run;
+
+static struct timespec run_wallstart;
+#ifdef TIMING
+static unsigned long long run_tickstart;
+#endif
+
+/* the names used in reports, in the order of the enums in stats.h */
+const char *counter_names[NCOUNTERS] = {
+  "messages_sent", "window_full", "tolayer3", "packets_resent", "timeouts",
+  "acks_received", "new_acks", "corrupt_received", "packets_received",
+  "messages_delivered", "lost", "corrupted", "reordered", "duplicated",
+  "fec_parity", "fec_recovered", "naks_sent", "nak_resends", "paced",
+  "spurious", "receive_buffer_full", "window_closed", "expired", "skipped",
+  "late"
+};
+
+const char *gauge_names[NGAUGES] = {
+  "outstanding", "inmedium", "events", "blocks", "receive_buffered"
+};
+
+const char *timing_names[NTIMINGS] = {
+  "A_output", "B_output", "A_input", "B_input", "A_timerinterrupt",
+  "B_timerinterrupt", "acktimerinterrupt", "pacetimerinterrupt", "insertevent", "tolayer3"
+};
+
+#ifdef TIMING
+/* processor cycles where they can be read directly, nanoseconds elsewhere */
+unsigned long long ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+#endif
+
+void run_start(void)
+{
+  clock_gettime(CLOCK_MONOTONIC, &run_wallstart);
+#ifdef TIMING
+  run_tickstart = ticks();
+#endif
+}
+
+double run_elapsed(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - run_wallstart.tv_sec) + (now.tv_nsec - run_wallstart.tv_nsec) / 1e9;
+}
+
+void run_stop(void)
+{
+  struct rusage ru;
+
+  run.wallseconds = run_elapsed();
+#ifdef TIMING
+  if (ticks() > run_tickstart)
+    run.ns_per_tick = run.wallseconds * 1e9 / (ticks() - run_tickstart);
+#endif
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+    run.maxrss = ru.ru_maxrss;    /* kilobytes on Linux */
+}
+
+void stats_init(void)
+{
+  int i;
+
+  for (i=0; i<NCOUNTERS; i++) {
+    counters[0][i] = 0;
+    counters[1][i] = 0;
+  }
+  for (i=0; i<NGAUGES; i++) {
+    gauges[i].value = 0;
+    gauges[i].max = 0;
+  }
+  for (i=0; i<NTIMINGS; i++) {
+    timings[i].ticks = 0;
+    timings[i].calls = 0;
+  }
+  run.events = 0;
+  run.allocations = 0;
+  run.wallseconds = 0.0;
+  run.maxrss = 0;
+  run.ns_per_tick = 0.0;
+}
+
+void stats_save(struct statsnapshot *s)
+{
+  memcpy(s->counters, counters, sizeof(counters));
+  memcpy(s->gauges, gauges, sizeof(gauges));
+  memcpy(s->timings, timings, sizeof(timings));
+  s->events = run.events;
+  s->allocations = run.allocations;
+}
+
+void stats_add(struct statsnapshot *s)
+{
+  int i;
+
+  for (i=0; i<NCOUNTERS; i++) {
+    counters[0][i] += s->counters[0][i];
+    counters[1][i] += s->counters[1][i];
+  }
+  for (i=0; i<NGAUGES; i++) {
+    gauges[i].value += s->gauges[i].value;
+    gauges[i].max += s->gauges[i].max;
+  }
+  for (i=0; i<NTIMINGS; i++) {
+    timings[i].ticks += s->timings[i].ticks;
+    timings[i].calls += s->timings[i].calls;
+  }
+  run.events += s->events;
+  run.allocations += s->allocations;
+}
+
+void stats_load(struct statsnapshot *s)
+{
+  memcpy(counters, s->counters, sizeof(counters));
+  memcpy(gauges, s->gauges, sizeof(gauges));
+  memcpy(timings, s->timings, sizeof(timings));
+  run.events = s->events;
+  run.allocations = s->allocations;
+}
+
+void stats_print_json(FILE *f)
+{
+  int i, side;
+
+  fprintf(f, "\"counters\": {");
+  for (side=0; side<2; side++) {
+    fprintf(f, "%s\"%c\": {", side ? ", " : "", 'A' + side);
+    for (i=0; i<NCOUNTERS; i++)
+      fprintf(f, "%s\"%s\": %ld", i ? ", " : "", counter_names[i], counters[side][i]);
+    fprintf(f, "}");
+  }
+  fprintf(f, "},\n \"gauges\": {");
+  for (i=0; i<NGAUGES; i++)
+    fprintf(f, "%s\"%s\": {\"value\": %ld, \"max\": %ld}", i ? ", " : "",
+            gauge_names[i], gauges[i].value, gauges[i].max);
+  fprintf(f, "}");
+  fprintf(f, ",\n \"run\": {\"events\": %ld, \"wall_seconds\": %f, \"events_per_second\": %.0f, "
+          "\"allocations\": %ld, \"max_rss_kb\": %ld}",
+          run.events, run.wallseconds,
+          run.wallseconds > 0.0 ? run.events / run.wallseconds : 0.0,
+          run.allocations, run.maxrss);
+#ifdef TIMING
+  fprintf(f, ",\n \"timings\": {");
+  for (i=0; i<NTIMINGS; i++)
+    fprintf(f, "%s\"%s\": {\"calls\": %ld, \"ticks\": %llu, \"ns_per_call\": %f}",
+            i ? ", " : "", timing_names[i], timings[i].calls, timings[i].ticks,
+            timings[i].calls ? timings[i].ticks * run.ns_per_tick / timings[i].calls : 0.0);
+  fprintf(f, "}");
+#endif
+}
+
+/* bucket number of a value counted in HIST_UNITs */
+static int hist_bucket(unsigned long long u)
+{
+  int msb, shift;
+
+  if (u < HIST_SUB)
+    return (int)u;
+  for (msb = HIST_SUBBITS; msb < 63 && (u >> (msb+1)) != 0; msb++)
+    ;
+  shift = msb - HIST_SUBBITS + 1;   /* leaves HIST_SUBBITS significant bits */
+  return HIST_SUB + (shift-1)*(HIST_SUB/2) + (int)(u >> shift) - HIST_SUB/2;
+}
+
+/* smallest value, in HIST_UNITs, that falls in a bucket */
+static unsigned long long hist_lowest(int bucket)
+{
+  int shift;
+
+  if (bucket < HIST_SUB)
+    return bucket;
+  shift = (bucket - HIST_SUB) / (HIST_SUB/2) + 1;
+  return (unsigned long long)((bucket - HIST_SUB) % (HIST_SUB/2) + HIST_SUB/2) << shift;
+}
+
+void hist_init(struct histogram *h)
+{
+  int i;
+
+  for (i=0; i<HIST_BUCKETS; i++)
+    h->counts[i] = 0;
+  h->total = 0;
+  h->sum = 0.0;
+  h->min = 0.0;
+  h->max = 0.0;
+}
+
+void hist_record(struct histogram *h, double value)
+{
+  if (value < 0.0)
+    value = 0.0;
+  h->counts[hist_bucket((unsigned long long)(value / HIST_UNIT))]++;
+  if (h->total == 0 || value < h->min)
+    h->min = value;
+  if (h->total == 0 || value > h->max)
+    h->max = value;
+  h->total++;
+  h->sum += value;
+}
+
+void hist_merge(struct histogram *h, struct histogram *from)
+{
+  int i;
+
+  if (from->total == 0)
+    return;
+  for (i=0; i<HIST_BUCKETS; i++)
+    h->counts[i] += from->counts[i];
+  if (h->total == 0 || from->min < h->min)
+    h->min = from->min;
+  if (h->total == 0 || from->max > h->max)
+    h->max = from->max;
+  h->total += from->total;
+  h->sum += from->sum;
+}
+
+double hist_percentile(struct histogram *h, double fraction)
+{
+  long wanted, seen = 0;
+  double value;
+  int i;
+
+  if (h->total == 0)
+    return 0.0;
+  wanted = (long)(fraction * h->total + 0.5);
+  if (wanted < 1)
+    wanted = 1;
+  for (i=0; i<HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= wanted)
+      break;
+  }
+  /* report the top of the bucket, but never beyond what was recorded */
+  value = (hist_lowest(i+1) - 1) * HIST_UNIT;
+  if (value > h->max)
+    value = h->max;
+  if (value < h->min)
+    value = h->min;
+  return value;
+}
+
+double hist_mean(struct histogram *h)
+{
+  if (h->total == 0)
+    return 0.0;
+  return h->sum / h->total;
+}
+
+void hist_print_json(FILE *f, struct histogram *h)
+{
+  int i, first = 1;
+
+  fprintf(f, "{\"count\": %ld, \"mean\": %f, \"min\": %f, \"max\": %f, ",
+          h->total, hist_mean(h), h->min, h->max);
+  fprintf(f, "\"p50\": %f, \"p90\": %f, \"p99\": %f, \"p999\": %f, ",
+          hist_percentile(h, 0.5), hist_percentile(h, 0.9),
+          hist_percentile(h, 0.99), hist_percentile(h, 0.999));
+  /* only the buckets in use, as [lowest value, count] pairs */
+  fprintf(f, "\"buckets\": [");
+  for (i=0; i<HIST_BUCKETS; i++)
+    if (h->counts[i] != 0) {
+      fprintf(f, "%s[%f, %ld]", first ? "" : ", ", hist_lowest(i) * HIST_UNIT, h->counts[i]);
+      first = 0;
+    }
+  fprintf(f, "]}");
+}
+
+void batch_init(struct batchmeans *b, int rate, double length)
+{
+  b->rate = rate;
+  b->length = length;
+  b->closed = 0;
+  b->sum[0] = 0.0;
+  b->count[0] = 0;
+}
+
+void batch_record(struct batchmeans *b, double value)
+{
+  b->sum[b->closed] += value;
+  b->count[b->closed]++;
+}
+
+void batch_close(struct batchmeans *b)
+{
+  int i;
+
+  if (++b->closed == BATCHES) {
+    for (i=0; i<BATCHES/2; i++) {
+      b->sum[i] = b->sum[2*i] + b->sum[2*i+1];
+      b->count[i] = b->count[2*i] + b->count[2*i+1];
+    }
+    b->closed = BATCHES/2;
+    b->length *= 2;
+  }
+  b->sum[b->closed] = 0.0;
+  b->count[b->closed] = 0;
+}
+
+/* Student's t for a 95% interval with df degrees of freedom, by the
+   Cornish-Fisher expansion about the normal quantile; within 0.1% from
+   the BATCHES_MIN - 1 degrees of freedom up */
+static double t95(int df)
+{
+  double z = 1.959964;
+
+  return z + (z*z*z + z) / (4*df) + (5*z*z*z*z*z + 16*z*z*z + 3*z) / (96.0*df*df);
+}
+
+int batch_interval(struct batchmeans *b, double *mean, double *halfwidth)
+{
+  double x, sum = 0.0, sumsq = 0.0;
+  int i, n = 0;
+
+  for (i=1; i<b->closed; i++) {
+    if (b->rate)
+      x = b->sum[i] / b->length;
+    else if (b->count[i] > 0)
+      x = b->sum[i] / b->count[i];
+    else
+      continue;         /* nothing to average */
+    sum += x;
+    sumsq += x*x;
+    n++;
+  }
+  if (n < BATCHES_MIN)
+    return 0;
+  *mean = sum / n;
+  x = (sumsq - sum*sum/n) / (n - 1);
+  *halfwidth = t95(n - 1) * sqrt(x > 0.0 ? x / n : 0.0);
+  return n;
+}
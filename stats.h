@@ -0,0 +1,224 @@
+/* ******************************************************************
+   Statistics kept by the emulator and the protocols for the end-of-run
+   report.
+
+   Counters are keyed at compile time, so COUNT() is a single increment
+   of a fixed array slot.  Each A or B counts what happens at itself:
+   a sender counts the packets it sends and the ACKs it receives, a
+   receiver the packets it receives and the messages it delivers.  SR
+   and GBN count by the same definitions, so their results compare.
+
+   Gauges hold a current value and remember the largest it has been.
+
+   The cost of a whole run, for benchmarking, is kept in run: events
+   handled, blocks allocated, wall-clock time and peak resident memory,
+   taken between run_start() and run_stop().
+
+   All of these are per thread, so the partitions of the parallel engine
+   count without sharing; stats_save() and stats_add() gather them up.
+
+   Compiled with -DTIMING, TIME_START()/TIME_STOP() accumulate processor
+   ticks spent in the emulator's event handlers; otherwise they vanish.
+   Times are inclusive, so A_input includes the tolayer3 calls it makes.
+
+   A histogram records non-negative values (times, in simulated time
+   units) to a resolution of HIST_UNIT with a relative error of under
+   1%, in the manner of an HDR histogram: values below HIST_SUB units
+   have a bucket each, and every doubling of the value above that is
+   split into HIST_SUB/2 buckets.
+
+   Batch means give a confidence interval on a measure of a run in
+   steady state.  Simulated time is cut into batches of equal length,
+   and the values recorded in a batch are either counted, the batch
+   standing for their rate per time unit, or averaged.  Once BATCHES
+   batches are closed, neighbours are merged and the length doubled,
+   so the batches grow long enough to be nearly independent however
+   long the run.  The first batch is the warm-up and is left out.
+   ******************************************************************/
+
+#define HIST_UNIT    0.001      /* smallest distinguishable value */
+#define HIST_SUBBITS 8
+#define HIST_SUB     (1 << HIST_SUBBITS)
+#define HIST_BUCKETS (HIST_SUB + (64 - HIST_SUBBITS) * (HIST_SUB / 2))
+
+struct histogram {
+  long counts[HIST_BUCKETS];
+  long total;                   /* number of values recorded */
+  double sum;                   /* sum of values recorded */
+  double min, max;
+};
+
+/* empty a histogram */
+extern void hist_init(struct histogram *);
+
+/* record one value */
+extern void hist_record(struct histogram *, double);
+
+/* value below which the given fraction (0.0 to 1.0) of values lie */
+extern double hist_percentile(struct histogram *, double);
+
+/* mean of the values recorded, 0.0 if there are none */
+extern double hist_mean(struct histogram *);
+
+/* add the values recorded in the second histogram to the first */
+extern void hist_merge(struct histogram *, struct histogram *);
+
+/* write the histogram as a JSON object */
+extern void hist_print_json(FILE *, struct histogram *);
+
+#define BATCHES      64
+#define BATCHES_MIN  10         /* fewest batches, after the warm-up, for an interval */
+
+struct batchmeans {
+  int rate;                     /* batches stand for the rate, not the mean */
+  double length;                /* simulated time in a batch */
+  int closed;                   /* batches closed; the open one is [closed] */
+  double sum[BATCHES + 1];      /* of the values recorded in each batch */
+  long count[BATCHES + 1];
+};
+
+/* start with no batches, the first of the given length */
+extern void batch_init(struct batchmeans *, int rate, double length);
+
+/* record one value in the open batch */
+extern void batch_record(struct batchmeans *, double);
+
+/* close the open batch, merging neighbours when all are closed */
+extern void batch_close(struct batchmeans *);
+
+/* the mean over the batches after the warm-up and the half-width of its
+   95% confidence interval; 0 if there are too few batches yet */
+extern int batch_interval(struct batchmeans *, double *mean, double *halfwidth);
+
+
+/* counters, indexed by A or B */
+enum counter {
+  C_MESSAGES_SENT,      /* messages given to the sender by layer 5 */
+  C_WINDOW_FULL,        /* messages dropped due to full window */
+  C_TOLAYER3,           /* packets sent into layer 3: data, ACKs and resends */
+  C_PACKETS_RESENT,     /* data packets sent again after a timeout */
+  C_TIMEOUTS,           /* expiries of the retransmission timer */
+  C_ACKS_RECEIVED,      /* uncorrupted ACKs received by the sender */
+  C_NEW_ACKS,           /* ACKs that acknowledged at least one packet not yet ACKed */
+  C_CORRUPT_RECEIVED,   /* corrupted packets received */
+  C_PACKETS_RECEIVED,   /* uncorrupted data packets received, in order or not */
+  C_MESSAGES_DELIVERED, /* messages delivered to layer 5 */
+  C_LOST,               /* packets sent that the medium lost */
+  C_CORRUPTED,          /* packets sent that the medium corrupted */
+  C_REORDERED,          /* packets sent that the medium held back */
+  C_DUPLICATED,         /* packets sent that the medium duplicated */
+  C_FEC_PARITY,         /* parity packets sent, with forward error correction */
+  C_FEC_RECOVERED,      /* data packets rebuilt from parity by the receiver */
+  C_NAKS_SENT,          /* NAKs sent by the receiver for holes in its window */
+  C_NAK_RESENDS,        /* data packets sent again on a NAK, not a timeout */
+  C_PACED,              /* new data packets the pacer held back for a token */
+  C_SPURIOUS,           /* data packets received again after a copy got through */
+  C_RCVBUF_FULL,        /* data packets dropped for want of receive buffer */
+  C_WINDOW_CLOSED,      /* new packets held back by the receiver's advertised window */
+  C_EXPIRED,            /* messages a sender gave up on past their deadline */
+  C_SKIPPED,            /* messages a receiver was told to pass over */
+  C_LATE,               /* messages a receiver had past their deadline, and passed over */
+  NCOUNTERS
+};
+
+extern _Thread_local long counters[2][NCOUNTERS];
+extern const char *counter_names[NCOUNTERS];
+
+#define COUNT(AorB, c)  (counters[AorB][c]++)
+
+/* gauges */
+enum gauge {
+  G_OUTSTANDING,        /* messages accepted by a sender and not yet delivered */
+  G_INMEDIUM,           /* packets in the medium */
+  G_EVENTS,             /* events on the event list */
+  G_BLOCKS,             /* blocks allocated by the emulator and not yet freed */
+  G_RCVBUFFERED,        /* packets held in receive buffers */
+  NGAUGES
+};
+
+struct gaugevalue {
+  long value;
+  long max;
+};
+
+extern _Thread_local struct gaugevalue gauges[NGAUGES];
+extern const char *gauge_names[NGAUGES];
+
+#define GAUGE_ADD(g, n)  do { gauges[g].value += (n); \
+                              if (gauges[g].value > gauges[g].max) gauges[g].max = gauges[g].value; } while (0)
+
+/* handlers whose time is measured with -DTIMING */
+enum timing {
+  T_A_OUTPUT,
+  T_B_OUTPUT,
+  T_A_INPUT,
+  T_B_INPUT,
+  T_A_TIMERINTERRUPT,
+  T_B_TIMERINTERRUPT,
+  T_ACKTIMERINTERRUPT,
+  T_PACETIMERINTERRUPT,
+  T_INSERTEVENT,
+  T_TOLAYER3,
+  NTIMINGS
+};
+
+struct timingvalue {
+  unsigned long long ticks;
+  long calls;
+};
+
+extern _Thread_local struct timingvalue timings[NTIMINGS];
+extern const char *timing_names[NTIMINGS];
+
+#ifdef TIMING
+extern unsigned long long ticks(void);
+#define TIME_START(t)  unsigned long long t##_start = ticks()
+#define TIME_STOP(t)   (timings[t].ticks += ticks() - t##_start, timings[t].calls++)
+#else
+#define TIME_START(t)  ((void)0)
+#define TIME_STOP(t)   ((void)0)
+#endif
+
+/* what a whole run cost */
+struct runcost {
+  long events;                  /* events taken off the event list */
+  long allocations;             /* blocks allocated by the emulator */
+  double wallseconds;           /* wall-clock time from run_start() to run_stop() */
+  long maxrss;                  /* peak resident memory, in kilobytes */
+  double ns_per_tick;           /* calibration of the TIMING ticks, 0.0 without */
+};
+
+extern _Thread_local struct runcost run;
+
+/* start and stop the wall clock for run; run_stop() also fills in maxrss
+   and ns_per_tick */
+extern void run_start(void);
+extern void run_stop(void);
+
+/* wall-clock seconds since run_start() */
+extern double run_elapsed(void);
+
+/* zero all counters, gauges and timings */
+extern void stats_init(void);
+
+/* a copy of one thread's counters, gauges, timings and run */
+struct statsnapshot {
+  long counters[2][NCOUNTERS];
+  struct gaugevalue gauges[NGAUGES];
+  struct timingvalue timings[NTIMINGS];
+  long events, allocations;
+};
+
+/* copy this thread's statistics */
+extern void stats_save(struct statsnapshot *);
+
+/* add a copy to this thread's statistics.  Gauge values add up; the
+   maxima are added too, so they are an upper bound */
+extern void stats_add(struct statsnapshot *);
+
+/* replace this thread's statistics with a copy, as when a checkpoint
+   is restored */
+extern void stats_load(struct statsnapshot *);
+
+/* write the counters, gauges and timings as the members of a JSON object */
+extern void stats_print_json(FILE *);
@@ -0,0 +1,1080 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "protocol.h"
+#include "stats.h"
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+/* ******************************************************************
+   Real network backend: A and B talk over a pair of UDP sockets on the
+   loopback interface instead of through the emulator.
+
+   It provides the same calls as the emulator (tolayer3, tolayer5 and the
+   timers, see emulator.h), so sr.c and gbn.c link with it unchanged, and
+   asks the same questions on stdin, so the workloads run on both.  A time
+   unit of the protocols becomes scale microseconds of wall-clock time.
+   The loop waits in epoll for the two sockets and a timerfd, which is
+   armed for the earliest timer, message from layer 5 or held back packet.
+   Packets are received in batches with recvmmsg(), and the packets sent
+   while handling one wakeup go out together with sendmmsg().
+
+   Where the kernel has io_uring, and unless -E asks for epoll, the loop
+   uses it instead: each packet sent is copied into a buffer registered
+   with the ring and written from there, a multishot recv on each socket
+   receives into registered buffers, and the writes queued while handling
+   one wakeup are submitted by the same io_uring_enter() that waits for
+   the next completions or deadline, so a batch costs one system call.
+
+   Loss and corruption are done here, before a packet reaches its socket,
+   as the emulator does them.  With -D packets are also held back 1 to 10
+   time units, in order, like the emulator's medium; without it they see
+   only the delay of the loopback.  A packet the socket will not take is
+   counted as lost.
+   ******************************************************************/
+
+#define BATCH 64               /* packets per sendmmsg() or recvmmsg() */
+#define NS_PER_US 1000LL
+#define NS_PER_S  1000000000LL
+
+#define ENTITY(flow, AorB)  (2*(flow) + (AorB))
+#define FLOW(entity)        ((entity) / 2)
+#define SIDE(entity)        ((entity) % 2)
+
+int TRACE = 0;
+int bidirectional = BIDIRECTIONAL;
+int nflows = 1;
+_Thread_local int current_flow = 0;
+
+static int nsim = 0;               /* messages from layer 5 so far */
+static int nsimmax = 0;
+static float lossprob;
+static float corruptprob;
+static int corruptdirection;
+static float lambda;
+
+static double scale = 1000.0;      /* microseconds per time unit */
+static int delayshim = 0;          /* hold packets back as the emulator does */
+static double timeout = 60.0;      /* seconds before a run is given up */
+static char *jsonfile = NULL;
+static const struct protocol *protocol = NULL;  /* the first linked in, unless -P */
+
+static int sock[2];                /* the sockets of A and of B */
+static int timer;                  /* timerfd for the earliest deadline */
+static long long armed;            /* the deadline it is armed for, 0 if none */
+static int useepoll = 0;           /* -E: epoll even where there is io_uring */
+static int uring = 0;              /* the io_uring transport is in use */
+
+/* deadlines in nanoseconds of CLOCK_MONOTONIC, 0 when not set.  The
+   delayed ACK timers follow the retransmission ones, and the pacing
+   timers follow them, as in the emulator */
+#define RESEND_TIMER 0
+#define ACK_TIMER    1
+#define PACE_TIMER   2
+#define NTIMERS      3
+static long long *timers;
+static long long *arrivals;        /* next message from layer 5, indexed by flow */
+static long long start;
+
+/* packets to send with the next sendmmsg(), indexed by the sending side */
+struct outbox {
+  struct pkt pkts[BATCH];
+  int count;
+};
+static struct outbox outbox[2];
+
+/* packets held back by the delay shim, oldest first, indexed by the
+   entity they are for, as the emulator's medium keeps the packets of
+   each flow in order */
+struct held {
+  long long release;
+  struct pkt packet;
+};
+struct delayline {
+  struct held *q;
+  int first, count, size;
+  long long last;                  /* release time of the newest packet */
+};
+static struct delayline *delayline;
+
+/* send times of the messages accepted and not yet delivered, indexed by
+   the sending entity, for the message delay */
+struct sendtimes {
+  long long *t;
+  int first, count, size;
+};
+static struct sendtimes *unacked;
+static struct histogram latency[2];
+static long accepted[2];           /* messages accepted by A and by B */
+
+static long long now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NS_PER_S + ts.tv_nsec;
+}
+
+/* nanoseconds in the given number of time units */
+static long long units(double t)
+{
+  return (long long)(t * scale * NS_PER_US);
+}
+
+static double jimsrand(void)
+{
+  return rand() / (double)RAND_MAX;
+}
+
+static void *xmalloc(size_t size, char *what)
+{
+  void *p = malloc(size);
+
+  if (p == NULL) {
+    printf("memory allocation for %s failed.", what);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/********************** SOCKETS ***********************/
+
+/* send the packets waiting in a side's outbox */
+static void flush(int side)
+{
+  struct outbox *o = &outbox[side];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, sent = 0, n;
+
+  if (o->count == 0)
+    return;
+  memset(msgs, 0, o->count * sizeof(struct mmsghdr));
+  for (i=0; i<o->count; i++) {
+    iov[i].iov_base = &o->pkts[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (sent < o->count) {
+    n = sendmmsg(sock[side], msgs + sent, o->count - sent, 0);
+    if (n <= 0)
+      break;
+    sent += n;
+  }
+  if (sent < o->count) {
+    counters[side][C_LOST] += o->count - sent;
+    if (TRACE>0)
+      printf("          FLUSH: socket refused %d packets\n", o->count - sent);
+  }
+  o->count = 0;
+}
+
+static void uring_send(int side, struct pkt *packet);
+
+static void queue(int side, struct pkt *packet)
+{
+  if (uring) {
+    uring_send(side, packet);
+    return;
+  }
+  if (outbox[side].count == BATCH)
+    flush(side);
+  outbox[side].pkts[outbox[side].count++] = *packet;
+}
+
+/* hold a packet from A or B back until 1 to 10 time units after the
+   newest one held for the same entity */
+static void hold(int AorB, struct pkt *packet)
+{
+  struct delayline *d = &delayline[ENTITY(packet->connid, (AorB+1) % 2)];
+  struct held *q;
+  long long t = now();
+  int i;
+
+  if (d->count == d->size) {
+    q = xmalloc((d->size ? 2*d->size : 64) * sizeof(struct held), "held packets");
+    for (i=0; i<d->count; i++)
+      q[i] = d->q[(d->first + i) % d->size];
+    free(d->q);
+    d->q = q;
+    d->first = 0;
+    d->size = d->size ? 2*d->size : 64;
+  }
+  if (d->last > t)
+    t = d->last;
+  t += units(1 + 9*jimsrand());
+  d->last = t;
+  q = &d->q[(d->first + d->count) % d->size];
+  q->release = t;
+  q->packet = *packet;
+  d->count++;
+}
+
+/* pass the packets held for entity that are due to the sender's outbox */
+static void release(int entity, long long t)
+{
+  struct delayline *d = &delayline[entity];
+
+  while (d->count > 0 && d->q[d->first].release <= t) {
+    queue((SIDE(entity)+1) % 2, &d->q[d->first].packet);
+    d->first = (d->first + 1) % d->size;
+    d->count--;
+  }
+}
+
+/* hand a packet of len bytes received at a side's socket to A or B */
+static void input(int side, struct pkt *packet, unsigned len)
+{
+  if (len != sizeof(struct pkt) || packet->connid < 0 || packet->connid >= nflows)
+    return;
+  current_flow = packet->connid;
+  if (side == A) {
+    TIME_START(T_A_INPUT);
+    protocol->A_input(*packet);
+    TIME_STOP(T_A_INPUT);
+  }
+  else {
+    TIME_START(T_B_INPUT);
+    protocol->B_input(*packet);
+    TIME_STOP(T_B_INPUT);
+  }
+}
+
+/* hand the packets waiting at a side's socket to A or B */
+static void receive(int side)
+{
+  struct pkt pkts[BATCH];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n;
+
+  do {
+    memset(msgs, 0, sizeof(msgs));
+    for (i=0; i<BATCH; i++) {
+      iov[i].iov_base = &pkts[i];
+      iov[i].iov_len = sizeof(struct pkt);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(sock[side], msgs, BATCH, MSG_DONTWAIT, NULL);
+    for (i=0; i<n; i++)
+      input(side, &pkts[i], msgs[i].msg_len);
+  } while (n == BATCH);
+}
+
+/* a non-blocking UDP socket on the loopback interface, on any port */
+static int opensocket(struct sockaddr_in *addr)
+{
+  socklen_t len = sizeof(*addr);
+  int s;
+
+  s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr->sin_port = 0;
+  if (s < 0 || bind(s, (struct sockaddr *)addr, sizeof(*addr)) < 0
+      || getsockname(s, (struct sockaddr *)addr, &len) < 0) {
+    perror("unable to open a UDP socket");
+    exit(EXIT_FAILURE);
+  }
+  return s;
+}
+
+/********************** IO_URING ***********************/
+
+/* The buffers registered with the ring are one array of packets.  The
+   first RECVSLOTS are also a provided buffer ring, from which a multishot
+   recv on each socket takes one per packet, so packets come off a socket
+   in order and a batch of them needs no new requests.  The other SENDSLOTS
+   are written from with IORING_OP_WRITE_FIXED.  Completed receives wait on
+   the ready queue until the loop hands them to A or B and gives their
+   buffers back, so that no protocol routine is called while a write is
+   waiting for a free buffer.  The user data of a recv is its side, that
+   of a write 2 more than its buffer */
+#define RECVSLOTS  128             /* a power of 2, for the buffer ring */
+#define SENDSLOTS  256
+#define NSLOTS     (RECVSLOTS + SENDSLOTS)
+#define RINGSIZE   512             /* enough for every buffer to be in use */
+#define RECVGROUP  0
+
+#ifdef HAVE_IO_URING
+struct ring {
+  int fd;
+  _Atomic unsigned *sqhead, *sqtail, *cqhead, *cqtail;
+  unsigned *sqarray, sqmask, cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned entries;
+  struct io_uring_buf_ring *bufs; /* the provided buffers for receiving */
+  unsigned short bufstail;
+};
+static struct ring ring;
+#endif
+static struct pkt *slots;          /* the registered buffers */
+static int sendside[SENDSLOTS];    /* the side writing each send buffer */
+static int freesend[SENDSLOTS];    /* send buffers not in use */
+static int nfree;
+static int receiving[2];           /* the recv on each socket is still armed */
+struct ready {
+  int side, slot;
+  unsigned len;
+};
+static struct ready ready[RECVSLOTS];   /* completed receives, oldest first */
+static int readyfirst, readycount;
+
+#ifdef HAVE_IO_URING
+/* submit the queued requests and, with wait, wait until one completes or
+   until the deadline, 0 for none */
+static void uring_enter(int wait, long long deadline)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  unsigned flags = 0, queued;
+  long long left;
+
+  memset(&arg, 0, sizeof(arg));
+  if (wait) {
+    flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    /* wake at least once a second, to notice the timeout */
+    left = deadline != 0 ? deadline - now() : NS_PER_S;
+    if (left > NS_PER_S)
+      left = NS_PER_S;
+    if (left < 0)
+      left = 0;
+    ts.tv_sec = left / NS_PER_S;
+    ts.tv_nsec = left % NS_PER_S;
+    arg.ts = (unsigned long)&ts;
+  }
+  /* requests the kernel has not taken yet */
+  queued = atomic_load_explicit(ring.sqtail, memory_order_relaxed)
+           - atomic_load_explicit(ring.sqhead, memory_order_acquire);
+  syscall(__NR_io_uring_enter, ring.fd, queued, wait, flags, wait ? &arg : NULL, sizeof(arg));
+}
+
+/* a cleared submission queue entry, submitting the queued ones if the
+   queue is full; uring_queue() adds it to the queue once filled in */
+static struct io_uring_sqe *uring_sqe(void)
+{
+  unsigned tail = atomic_load_explicit(ring.sqtail, memory_order_relaxed);
+  struct io_uring_sqe *sqe;
+
+  while (tail - atomic_load_explicit(ring.sqhead, memory_order_acquire) == ring.entries)
+    uring_enter(0, 0);
+  sqe = &ring.sqes[tail & ring.sqmask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sqarray[tail & ring.sqmask] = tail & ring.sqmask;
+  return sqe;
+}
+
+static void uring_queue(void)
+{
+  atomic_store_explicit(ring.sqtail, atomic_load_explicit(ring.sqtail, memory_order_relaxed) + 1,
+                        memory_order_release);
+}
+
+/* arm a multishot recv on a side's socket */
+static void uring_recv(int side)
+{
+  struct io_uring_sqe *sqe = uring_sqe();
+
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = sock[side];
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->buf_group = RECVGROUP;
+  sqe->user_data = side;
+  uring_queue();
+  receiving[side] = 1;
+}
+
+/* give a receive buffer back to the buffer ring */
+static void uring_giveback(int slot)
+{
+  struct io_uring_buf *b = &ring.bufs->bufs[ring.bufstail & (RECVSLOTS - 1)];
+
+  b->addr = (unsigned long)&slots[slot];
+  b->len = sizeof(struct pkt);
+  b->bid = slot;
+  ring.bufstail++;
+  atomic_store_explicit((_Atomic unsigned short *)&ring.bufs->tail, ring.bufstail, memory_order_release);
+}
+
+/* take the completions off the ring: free the send buffers, and put the
+   receives on the ready queue */
+static void uring_reap(void)
+{
+  unsigned head = atomic_load_explicit(ring.cqhead, memory_order_relaxed);
+  struct io_uring_cqe *cqe;
+  struct ready *r;
+  int slot;
+
+  for (; head != atomic_load_explicit(ring.cqtail, memory_order_acquire); head++) {
+    cqe = &ring.cqes[head & ring.cqmask];
+    if (cqe->user_data >= 2) {
+      slot = cqe->user_data - 2;
+      if (cqe->res != sizeof(struct pkt)) {
+        counters[sendside[slot]][C_LOST]++;
+        if (TRACE>0)
+          printf("          FLUSH: socket refused a packet\n");
+      }
+      freesend[nfree++] = slot;
+    }
+    else {
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+        receiving[cqe->user_data] = 0;     /* out of buffers; armed again once some are back */
+      if (cqe->flags & IORING_CQE_F_BUFFER) {
+        r = &ready[(readyfirst + readycount) % RECVSLOTS];
+        r->side = cqe->user_data;
+        r->slot = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        r->len = cqe->res < 0 ? 0 : cqe->res;
+        readycount++;
+      }
+    }
+    run.events++;
+  }
+  atomic_store_explicit(ring.cqhead, head, memory_order_release);
+}
+
+/* set up the ring and register the buffers with it; 0 if the kernel
+   will not have it, and the sockets are left to epoll */
+static int uring_setup(void)
+{
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+  struct iovec iov;
+  size_t size;
+  char *sq;
+  int i;
+
+  memset(&p, 0, sizeof(p));
+  ring.fd = syscall(__NR_io_uring_setup, RINGSIZE, &p);
+  if (ring.fd < 0)
+    return 0;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+    close(ring.fd);
+    return 0;
+  }
+  size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > size)
+    size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  sq = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+  ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+  slots = mmap(NULL, NSLOTS * sizeof(struct pkt), PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ring.bufs = mmap(NULL, RECVSLOTS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  iov.iov_base = slots;
+  iov.iov_len = NSLOTS * sizeof(struct pkt);
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)ring.bufs;
+  reg.ring_entries = RECVSLOTS;
+  reg.bgid = RECVGROUP;
+  if (sq == MAP_FAILED || ring.sqes == MAP_FAILED || slots == MAP_FAILED || ring.bufs == MAP_FAILED
+      || syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, &iov, 1) < 0
+      || syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    close(ring.fd);
+    return 0;
+  }
+  ring.sqhead = (_Atomic unsigned *)(sq + p.sq_off.head);
+  ring.sqtail = (_Atomic unsigned *)(sq + p.sq_off.tail);
+  ring.sqmask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  ring.sqarray = (unsigned *)(sq + p.sq_off.array);
+  ring.cqhead = (_Atomic unsigned *)(sq + p.cq_off.head);
+  ring.cqtail = (_Atomic unsigned *)(sq + p.cq_off.tail);
+  ring.cqmask = *(unsigned *)(sq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+  ring.entries = p.sq_entries;
+  ring.bufstail = 0;
+
+  for (i=0; i<RECVSLOTS; i++)
+    uring_giveback(i);
+  for (i=0; i<SENDSLOTS; i++)
+    freesend[i] = i;
+  nfree = SENDSLOTS;
+  uring_recv(A);
+  uring_recv(B);
+  return 1;
+}
+
+/* copy a packet into a free send buffer and queue its write */
+static void uring_send(int side, struct pkt *packet)
+{
+  struct io_uring_sqe *sqe;
+  int slot;
+
+  while (nfree == 0) {
+    uring_enter(1, 0);
+    uring_reap();
+  }
+  slot = freesend[--nfree];
+  sendside[slot] = side;
+  slots[RECVSLOTS + slot] = *packet;
+  sqe = uring_sqe();
+  sqe->opcode = IORING_OP_WRITE_FIXED;
+  sqe->fd = sock[side];
+  sqe->addr = (unsigned long)&slots[RECVSLOTS + slot];
+  sqe->len = sizeof(struct pkt);
+  sqe->buf_index = 0;
+  sqe->user_data = 2 + slot;
+  uring_queue();
+}
+
+/* hand the completed receives to A or B, give their buffers back, and
+   arm the recv again on a socket that ran out of them */
+static void uring_input(void)
+{
+  struct ready r;
+
+  while (readycount > 0) {
+    r = ready[readyfirst];
+    readyfirst = (readyfirst + 1) % RECVSLOTS;
+    readycount--;
+    input(r.side, &slots[r.slot], r.len);
+    uring_giveback(r.slot);
+  }
+  if (!receiving[A])
+    uring_recv(A);
+  if (!receiving[B])
+    uring_recv(B);
+}
+#else
+static int uring_setup(void) { return 0; }
+static void uring_send(int side, struct pkt *packet) { (void)side; (void)packet; }
+static void uring_enter(int wait, long long deadline) { (void)wait; (void)deadline; }
+static void uring_reap(void) { }
+static void uring_input(void) { }
+#endif
+
+/********************** Student-callable ROUTINES ***********************/
+
+static void sendpacket(int AorB, struct pkt packet)
+{
+  float x;
+  int damage;
+
+  if (packet.connid < 0 || packet.connid >= nflows) {
+    printf("Warning: packet for unknown connection %d not sent.\n", packet.connid);
+    return;
+  }
+  COUNT(AorB, C_TOLAYER3);
+  damage = !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+  if (damage && jimsrand() < lossprob) {
+    COUNT(AorB, C_LOST);
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+  if (damage && jimsrand() < corruptprob) {
+    COUNT(AorB, C_CORRUPTED);
+    if ((x = jimsrand()) < .75)
+      packet.payload[0] = 'Z';
+    else if (x < .875)
+      packet.seqnum = 999999;
+    else
+      packet.acknum = 999999;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+  if (delayshim)
+    hold(AorB, &packet);
+  else
+    queue(AorB, &packet);
+}
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  TIME_START(T_TOLAYER3);
+  sendpacket(AorB, packet);
+  TIME_STOP(T_TOLAYER3);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  struct sendtimes *q = &unacked[ENTITY(current_flow, (AorB+1) % 2)];
+
+  if (TRACE>2)
+    printf("          TOLAYER5: data received by application at %c: %.20s\n", 'A' + AorB, datasent);
+  COUNT(AorB, C_MESSAGES_DELIVERED);
+  if (q->count == 0)
+    return;
+  hist_record(&latency[(AorB+1) % 2], (double)(now() - q->t[q->first]) / units(1));
+  q->first = (q->first + 1) % q->size;
+  q->count--;
+}
+
+/* messages are not given deadlines here, so none is ever lost */
+void tolayer5_lost(int AorB, int stream)
+{
+}
+
+double currenttime(void)
+{
+  return (double)(now() - start) / units(1);
+}
+
+/* the packets go out together with the rest of the wakeup's anyway */
+void tolayer3_batch(int AorB, struct pkt *packets, int n)
+{
+  int i;
+
+  TIME_START(T_TOLAYER3);
+  for (i=0; i<n; i++)
+    sendpacket(AorB, packets[i]);
+  TIME_STOP(T_TOLAYER3);
+}
+
+void tolayer5_batch(int AorB, struct msg *messages, int n)
+{
+  int i;
+
+  for (i=0; i<n; i++)
+    tolayer5(AorB, messages[i].data);
+}
+
+/* the application here reads as fast as it is given messages */
+int tolayer5_room(int AorB)
+{
+  return INT_MAX;
+}
+
+static long long *timerslot(int kind, int AorB)
+{
+  return &timers[kind*2*nflows + ENTITY(current_flow, AorB)];
+}
+
+static void settimer(int kind, int AorB, double increment)
+{
+  long long *slot = timerslot(kind, AorB);
+
+  if (*slot != 0) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  *slot = now() + units(increment);
+}
+
+static void cleartimer(int kind, int AorB)
+{
+  long long *slot = timerslot(kind, AorB);
+
+  if (*slot == 0) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  *slot = 0;
+}
+
+void starttimer(int AorB, double increment)
+{
+  settimer(RESEND_TIMER, AorB, increment);
+}
+
+void stoptimer(int AorB)
+{
+  cleartimer(RESEND_TIMER, AorB);
+}
+
+void startacktimer(int AorB, double increment)
+{
+  settimer(ACK_TIMER, AorB, increment);
+}
+
+void stopacktimer(int AorB)
+{
+  cleartimer(ACK_TIMER, AorB);
+}
+
+void startpacetimer(int AorB, double increment)
+{
+  settimer(PACE_TIMER, AorB, increment);
+}
+
+void stoppacetimer(int AorB)
+{
+  cleartimer(PACE_TIMER, AorB);
+}
+
+/********************** LAYER 5 AND TIMERS ***********************/
+
+/* give the flow's A, or with -b A or B, its next message */
+static void arrival(int flow, long long t)
+{
+  struct msg message;
+  struct sendtimes *q;
+  long long *n;
+  long dropped;
+  int side, i;
+
+  if (nsim == nsimmax) {
+    arrivals[flow] = 0;
+    return;
+  }
+  arrivals[flow] = t + units(lambda*jimsrand()*2);
+  side = (bidirectional && jimsrand() > 0.5) ? B : A;
+  for (i=0; i<20; i++)
+    message.data[i] = 'a' + nsim % 26;
+  message.stream = 0;
+  message.deadline = 0.0;
+  nsim++;
+  current_flow = flow;
+  COUNT(side, C_MESSAGES_SENT);
+  dropped = counters[side][C_WINDOW_FULL];
+  if (side == A) {
+    TIME_START(T_A_OUTPUT);
+    protocol->A_output(message);
+    TIME_STOP(T_A_OUTPUT);
+  }
+  else {
+    TIME_START(T_B_OUTPUT);
+    protocol->B_output(message);
+    TIME_STOP(T_B_OUTPUT);
+  }
+  if (counters[side][C_WINDOW_FULL] != dropped)
+    return;
+  accepted[side]++;
+  q = &unacked[ENTITY(flow, side)];
+  if (q->count == q->size) {
+    n = xmalloc((q->size ? 2*q->size : 16) * sizeof(long long), "send times");
+    for (i=0; i<q->count; i++)
+      n[i] = q->t[(q->first + i) % q->size];
+    free(q->t);
+    q->t = n;
+    q->first = 0;
+    q->size = q->size ? 2*q->size : 16;
+  }
+  q->t[(q->first + q->count) % q->size] = t;
+  q->count++;
+}
+
+/* call the handlers of every deadline that has passed, and return the
+   earliest one still to come, or 0 */
+static long long expire(long long t)
+{
+  long long next = 0;
+  int i;
+
+  for (i=0; i<NTIMERS * 2*nflows; i++) {
+    if (timers[i] != 0 && timers[i] <= t) {
+      timers[i] = 0;
+      current_flow = FLOW(i % (2*nflows));
+      if (i / (2*nflows) == PACE_TIMER) {
+        TIME_START(T_PACETIMERINTERRUPT);
+        if (SIDE(i) == A)
+          protocol->A_pacetimerinterrupt();
+        else
+          protocol->B_pacetimerinterrupt();
+        TIME_STOP(T_PACETIMERINTERRUPT);
+      }
+      else if (i / (2*nflows) == ACK_TIMER) {
+        TIME_START(T_ACKTIMERINTERRUPT);
+        if (SIDE(i) == A)
+          protocol->A_acktimerinterrupt();
+        else
+          protocol->B_acktimerinterrupt();
+        TIME_STOP(T_ACKTIMERINTERRUPT);
+      }
+      else if (SIDE(i) == A) {
+        COUNT(A, C_TIMEOUTS);
+        TIME_START(T_A_TIMERINTERRUPT);
+        protocol->A_timerinterrupt();
+        TIME_STOP(T_A_TIMERINTERRUPT);
+      }
+      else {
+        COUNT(B, C_TIMEOUTS);
+        TIME_START(T_B_TIMERINTERRUPT);
+        protocol->B_timerinterrupt();
+        TIME_STOP(T_B_TIMERINTERRUPT);
+      }
+    }
+  }
+  for (i=0; i<nflows; i++)
+    if (arrivals[i] != 0 && arrivals[i] <= t)
+      arrival(i, t);
+  if (delayshim)
+    for (i=0; i<2*nflows; i++)
+      release(i, t);
+
+  /* handlers may have started timers, so look again */
+  for (i=0; i<NTIMERS * 2*nflows; i++)
+    if (timers[i] != 0 && (next == 0 || timers[i] < next))
+      next = timers[i];
+  for (i=0; i<nflows; i++)
+    if (arrivals[i] != 0 && (next == 0 || arrivals[i] < next))
+      next = arrivals[i];
+  if (delayshim)
+    for (i=0; i<2*nflows; i++)
+      if (delayline[i].count > 0 && (next == 0 || delayline[i].q[delayline[i].first].release < next))
+        next = delayline[i].q[delayline[i].first].release;
+  return next;
+}
+
+static void arm(long long deadline)
+{
+  struct itimerspec its;
+
+  if (deadline == armed)
+    return;
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = deadline / NS_PER_S;
+  its.it_value.tv_nsec = deadline % NS_PER_S;
+  timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL);   /* 0 disarms */
+  armed = deadline;
+}
+
+/* every message has been given out, and every one accepted delivered */
+static int finished(void)
+{
+  return nsim == nsimmax && counters[B][C_MESSAGES_DELIVERED] >= accepted[A]
+         && counters[A][C_MESSAGES_DELIVERED] >= accepted[B];
+}
+
+/********************** SETUP AND REPORT ***********************/
+
+static void usage(char *progname)
+{
+  int i;
+
+  printf("usage: %s [-b] [-f nflows] [-S scale] [-D] [-E] [-T timeout] [-j jsonfile]\n       [-P protocol]\n", progname);
+  printf("  -b  bidirectional transfer, layer 5 gives messages to both A and B\n");
+  printf("  -f  number of flows (A and B pairs) sharing the sockets\n");
+  printf("  -S  microseconds of wall-clock time per time unit of the protocols\n");
+  printf("  -D  hold packets back 1 to 10 time units, as the emulator's medium does\n");
+  printf("  -E  wait in epoll even where io_uring is available\n");
+  printf("  -T  seconds before an unfinished run is given up\n");
+  printf("  -j  write the report and message delays to a JSON file\n");
+  printf("  -P  the protocol to run, of:");
+  for (i=0; protocols[i] != NULL; i++)
+    printf(" %s", protocols[i]->name);
+  printf("\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parseargs(int argc, char **argv)
+{
+  int c;
+
+  /* -b, -f, -j and -P are the emulator's; the others have letters it
+     does not use, so no option means one thing here and another there */
+  while ((c = getopt(argc, argv, "bf:S:DET:j:P:")) != -1) {
+    switch (c) {
+    case 'b':
+      bidirectional = 1;
+      break;
+    case 'f':
+      nflows = atoi(optarg);
+      break;
+    case 'S':
+      scale = atof(optarg);
+      break;
+    case 'D':
+      delayshim = 1;
+      break;
+    case 'E':
+      useepoll = 1;
+      break;
+    case 'T':
+      timeout = atof(optarg);
+      break;
+    case 'j':
+      jsonfile = optarg;
+      break;
+    case 'P':
+      if ((protocol = findprotocol(optarg)) == NULL)
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind < argc || nflows < 1 || scale <= 0.0 || timeout <= 0.0)
+    usage(argv[0]);
+  if (protocol == NULL)
+    protocol = protocols[0];
+  if (protocol->maxflows > 0 && nflows > protocol->maxflows) {
+    printf("%s is limited to -f %d\n", protocol->name, protocol->maxflows);
+    exit(EXIT_FAILURE);
+  }
+  if (bidirectional && !protocol->duplex) {
+    printf("%s only sends from A to B, so not -b\n", protocol->name);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void init(void)
+{
+  struct sockaddr_in addr[2];
+  int i;
+
+  printf("-----  UDP loopback network, %g us per time unit -------- \n\n", scale);
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d",&nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f",&lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f",&corruptprob);
+  if (lossprob != 0.0 || corruptprob != 0.0) {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d",&corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f",&lambda);
+  printf("Enter TRACE:");
+  scanf("%d",&TRACE);
+  printf("\n");
+  srand(9999);
+
+  stats_init();
+  hist_init(&latency[A]);
+  hist_init(&latency[B]);
+  timers = xmalloc(NTIMERS * 2*nflows * sizeof(long long), "flows");
+  arrivals = xmalloc(nflows * sizeof(long long), "flows");
+  unacked = xmalloc(2*nflows * sizeof(struct sendtimes), "flows");
+  delayline = xmalloc(2*nflows * sizeof(struct delayline), "flows");
+  for (i=0; i<NTIMERS * 2*nflows; i++)
+    timers[i] = 0;
+  for (i=0; i<2*nflows; i++) {
+    unacked[i].t = NULL;
+    unacked[i].first = unacked[i].count = unacked[i].size = 0;
+    delayline[i].q = NULL;
+    delayline[i].first = delayline[i].count = delayline[i].size = 0;
+    delayline[i].last = 0;
+  }
+
+  sock[A] = opensocket(&addr[A]);
+  sock[B] = opensocket(&addr[B]);
+  if (connect(sock[A], (struct sockaddr *)&addr[B], sizeof(addr[B])) < 0
+      || connect(sock[B], (struct sockaddr *)&addr[A], sizeof(addr[A])) < 0) {
+    perror("unable to connect the UDP sockets");
+    exit(EXIT_FAILURE);
+  }
+  timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  armed = 0;
+  uring = !useepoll && uring_setup();
+
+  start = now();
+  for (i=0; i<nflows; i++)
+    arrivals[i] = start + units(lambda*jimsrand()*2);
+}
+
+static void printstats(int from, int to, double seconds)
+{
+  printf("number of messages dropped due to full window:  %ld \n", counters[from][C_WINDOW_FULL]);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at %c:  %ld \n", 'A' + from, counters[from][C_NEW_ACKS]);
+  printf("number of packet resends by %c:  %ld \n", 'A' + from, counters[from][C_PACKETS_RESENT]);
+  printf("number of correct packets received at %c:  %ld \n", 'A' + to, counters[to][C_PACKETS_RECEIVED]);
+  printf("number of messages delivered to application:  %ld \n", counters[to][C_MESSAGES_DELIVERED]);
+  printf("messages delivered per second:  %f \n", counters[to][C_MESSAGES_DELIVERED] / seconds);
+  if (latency[from].total > 0)
+    printf("message delay from %c to %c in time units:  mean %f  p50 %f  p99 %f  p999 %f  max %f \n",
+           'A' + from, 'A' + to, hist_mean(&latency[from]), hist_percentile(&latency[from], 0.5),
+           hist_percentile(&latency[from], 0.99), hist_percentile(&latency[from], 0.999),
+           latency[from].max);
+}
+
+static void writejson(double seconds)
+{
+  FILE *f;
+
+  if ((f = fopen(jsonfile, "w")) == NULL) {
+    printf("unable to write %s\n", jsonfile);
+    return;
+  }
+  fprintf(f, "{\"backend\": \"udp\", \"transport\": \"%s\", \"scale_us\": %f, \"seconds\": %f, \"messages\": %d, \"flows\": %d,\n ",
+          uring ? "io_uring" : "epoll", scale, seconds, nsim, nflows);
+  fprintf(f, "\"goodput_per_second\": %f,\n ",
+          (counters[A][C_MESSAGES_DELIVERED] + counters[B][C_MESSAGES_DELIVERED]) / seconds);
+  stats_print_json(f);
+  fprintf(f, ",\n \"latency\": {\"A_to_B\": ");
+  hist_print_json(f, &latency[A]);
+  fprintf(f, ", \"B_to_A\": ");
+  hist_print_json(f, &latency[B]);
+  fprintf(f, "}}\n");
+  fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+  struct epoll_event ev, events[3];
+  long long t, next, expirations;
+  double seconds;
+  int ep, n, i;
+
+  parseargs(argc, argv);
+  init();
+  for (current_flow=0; current_flow<nflows; current_flow++) {
+    protocol->A_init();
+    protocol->B_init();
+  }
+
+  ep = epoll_create1(0);
+  ev.events = EPOLLIN;
+  ev.data.fd = sock[A];
+  epoll_ctl(ep, EPOLL_CTL_ADD, sock[A], &ev);
+  ev.data.fd = sock[B];
+  epoll_ctl(ep, EPOLL_CTL_ADD, sock[B], &ev);
+  ev.data.fd = timer;
+  epoll_ctl(ep, EPOLL_CTL_ADD, timer, &ev);
+
+  run_start();
+  while (!finished()) {
+    t = now();
+    if (t - start > timeout * NS_PER_S) {
+      printf("Warning: giving up after %g seconds\n", timeout);
+      break;
+    }
+    next = expire(t);
+    if (uring) {
+      uring_enter(1, next);
+      uring_reap();
+      uring_input();
+      continue;
+    }
+    flush(A);
+    flush(B);
+    arm(next);
+    /* wake at least once a second, to notice the timeout */
+    n = epoll_wait(ep, events, 3, 1000);
+    for (i=0; i<n; i++) {
+      if (events[i].data.fd == timer) {
+        if (read(timer, &expirations, sizeof(expirations)) > 0)
+          armed = 0;
+      }
+      else
+        receive(events[i].data.fd == sock[A] ? A : B);
+      run.events++;
+    }
+  }
+  run_stop();
+  seconds = run.wallseconds;
+
+  printf(" Network ran for %f s over %s\n after attempting to send %d msgs from layer5\n", seconds,
+         uring ? "io_uring" : "epoll", nsim);
+  printstats(A, B, seconds);
+  if (bidirectional) {
+    printf("\n---- B->A ----\n");
+    printstats(B, A, seconds);
+  }
+  printf("packets lost or corrupted on purpose:  %ld / %ld \n",
+         counters[A][C_LOST] + counters[B][C_LOST], counters[A][C_CORRUPTED] + counters[B][C_CORRUPTED]);
+  if (jsonfile != NULL)
+    writejson(seconds);
+  return EXIT_SUCCESS;
+}